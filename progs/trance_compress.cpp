@@ -0,0 +1,250 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+//
+// compress the shift/reduce/unary weights of a trained model by low-rank factors for inference,
+// and report the F1 of the original and the compressed models on a held-out treebank
+//
+
+#include <iostream>
+
+#include <trance/evalb.hpp>
+#include <trance/tree.hpp>
+#include <trance/grammar.hpp>
+#include <trance/signature.hpp>
+#include <trance/feature_set.hpp>
+#include <trance/model_traits.hpp>
+#include <trance/parser.hpp>
+
+#include "utils/compress_stream.hpp"
+#include "utils/lexical_cast.hpp"
+#include "utils/resource.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+typedef trance::Tree       tree_type;
+typedef trance::Grammar    grammar_type;
+typedef trance::Signature  signature_type;
+typedef trance::FeatureSet feature_set_type;
+typedef trance::Model      model_type;
+typedef trance::Evalb      evalb_type;
+
+typedef model_type::low_rank_type low_rank_type;
+
+typedef boost::filesystem::path path_type;
+typedef std::vector<std::string, std::allocator<std::string> > feat_set_type;
+typedef std::vector<tree_type, std::allocator<tree_type> > tree_set_type;
+
+path_type model_file;
+path_type output_file;
+
+int rank = 0;
+double energy = 0.99;
+
+path_type test_file;
+path_type grammar_file;
+std::string signature_name = "none";
+feat_set_type feature_functions;
+
+int hidden_size = 64;
+int embedding_size = 64;
+
+int beam_size = 64;
+int unary_size = 3;
+
+int debug = 0;
+
+template <typename Theta>
+void compress(const path_type& input_path, const path_type& output_path);
+void options(int argc, char** argv);
+
+int main(int argc, char** argv)
+{
+  try {
+    options(argc, argv);
+
+    if (model_file.empty() || ! boost::filesystem::exists(model_file))
+      throw std::runtime_error("no model file? " + model_file.string());
+    if (output_file.empty() && test_file.empty())
+      throw std::runtime_error("no output file?");
+    if (! output_file.empty() && boost::filesystem::exists(output_file) && boost::filesystem::equivalent(model_file, output_file))
+      throw std::runtime_error("the output overwrites the model: " + output_file.string());
+
+    if (rank < 0)
+      throw std::runtime_error("invalid rank: " + utils::lexical_cast<std::string>(rank));
+    if (energy <= 0.0 || energy > 1.0)
+      throw std::runtime_error("invalid energy: " + utils::lexical_cast<std::string>(energy));
+
+    if (! test_file.empty()) {
+      if (test_file != "-" && ! boost::filesystem::exists(test_file))
+	throw std::runtime_error("no test file? " + test_file.string());
+      if (grammar_file != "-" && ! boost::filesystem::exists(grammar_file))
+	throw std::runtime_error("no grammar file? " + grammar_file.string());
+      if (beam_size <= 0)
+	throw std::runtime_error("invalid beam size: " + utils::lexical_cast<std::string>(beam_size));
+      if (unary_size < 0)
+	throw std::runtime_error("invalid unary size: " + utils::lexical_cast<std::string>(unary_size));
+    }
+
+    switch (model_type::model(model_file)) {
+    case trance::model::MODEL1: compress<trance::model::Model1>(model_file, output_file); break;
+    case trance::model::MODEL2: compress<trance::model::Model2>(model_file, output_file); break;
+    case trance::model::MODEL3: compress<trance::model::Model3>(model_file, output_file); break;
+    case trance::model::MODEL4: compress<trance::model::Model4>(model_file, output_file); break;
+    case trance::model::MODEL5: compress<trance::model::Model5>(model_file, output_file); break;
+    default:
+      throw std::runtime_error("invalid model file");
+    }
+  }
+  catch (const std::exception& err) {
+    std::cerr << "error: " << err.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+template <typename Theta>
+evalb_type evaluate(const tree_set_type& trees,
+		    const grammar_type& grammar,
+		    const signature_type& signature,
+		    const feature_set_type& feats,
+		    const Theta& theta)
+{
+  trance::Parser parser(beam_size, unary_size);
+  trance::Parser::derivation_set_type candidates;
+
+  parser.materialize_ = false;
+
+  feature_set_type feats_folded(feats.clone());
+  feats_folded.fold(theta.Wfe_);
+
+  trance::EvalbScorer scorer;
+  evalb_type evalb;
+
+  tree_set_type::const_iterator titer_end = trees.end();
+  for (tree_set_type::const_iterator titer = trees.begin(); titer != titer_end; ++ titer) {
+    parser(titer->leaf(), grammar, signature, feats_folded, theta, 1, candidates);
+
+    if (candidates.empty()) continue;
+
+    scorer.assign(*titer);
+    evalb += scorer(candidates.front());
+  }
+
+  return evalb;
+}
+
+inline
+void statistics(const char* name, const low_rank_type& low_rank, const size_t size)
+{
+  const size_t blocks = low_rank.offsets_.size() - 1;
+  const size_t ranks  = low_rank.offsets_.back();
+
+  size_t rank_max = 0;
+  for (size_t i = 0; i != blocks; ++ i)
+    rank_max = std::max(rank_max, low_rank.offsets_[i + 1] - low_rank.offsets_[i]);
+
+  std::cerr << name
+	    << " rank: " << (blocks ? double(ranks) / blocks : 0.0)
+	    << " max: " << rank_max
+	    << " bytes: " << low_rank.size_bytes()
+	    << " float bytes: " << sizeof(model_type::parameter_type) * size
+	    << std::endl;
+}
+
+template <typename Theta>
+void compress(const path_type& input_path, const path_type& output_path)
+{
+  tree_set_type trees;
+
+  if (! test_file.empty()) {
+    utils::compress_istream is(test_file, 1024 * 1024);
+
+    tree_type tree;
+    while (is >> tree)
+      if (! tree.empty())
+	trees.push_back(tree);
+
+    if (debug)
+      std::cerr << "# of test data: " << trees.size() << std::endl;
+  }
+
+  grammar_type grammar(grammar_file);
+
+  signature_type::signature_ptr_type signature(signature_type::create(signature_name));
+
+  feature_set_type feats(feature_functions.begin(), feature_functions.end());
+
+  Theta theta(hidden_size, embedding_size, grammar);
+
+  theta.read(input_path);
+
+  evalb_type evalb_original;
+  if (! trees.empty())
+    evalb_original = evaluate(trees, grammar, *signature, feats, theta);
+
+  utils::resource start;
+
+  theta.compress(rank, energy);
+
+  utils::resource end;
+
+  if (debug) {
+    std::cerr << "compression:"
+	      << " cpu time: " << end.cpu_time() - start.cpu_time()
+	      << " user time: " << end.user_time() - start.user_time()
+	      << std::endl;
+
+    statistics("Wsh", theta.Lsh_, theta.Wsh_.size());
+    statistics("Wre", theta.Lre_, theta.Wre_.size());
+    statistics("Wu",  theta.Lu_,  theta.Wu_.size());
+  }
+
+  if (! trees.empty()) {
+    const evalb_type evalb_compressed = evaluate(trees, grammar, *signature, feats, theta);
+
+    std::cerr << "F1 original: " << evalb_original()
+	      << " compressed: " << evalb_compressed()
+	      << " delta: " << (evalb_compressed() - evalb_original())
+	      << std::endl;
+  }
+
+  if (! output_path.empty())
+    theta.write(output_path);
+}
+
+void options(int argc, char** argv)
+{
+  namespace po = boost::program_options;
+
+  po::options_description desc("options");
+  desc.add_options()
+    ("model",    po::value<path_type>(&model_file),                         "model file")
+    ("output",   po::value<path_type>(&output_file),                        "output model file")
+    ("rank",     po::value<int>(&rank)->default_value(rank),                "maximum rank for each category (0 for the hidden dimension)")
+    ("energy",   po::value<double>(&energy)->default_value(energy),         "fraction of the squared singular values kept for each category")
+
+    ("test",      po::value<path_type>(&test_file),                                       "held-out treebank to report F1")
+    ("grammar",   po::value<path_type>(&grammar_file),                                    "grammar file")
+    ("signature", po::value<std::string>(&signature_name)->default_value(signature_name), "language specific signature")
+    ("feature",   po::value<feat_set_type>(&feature_functions)->composing(),              "feature function(s)")
+    ("hidden",    po::value<int>(&hidden_size)->default_value(hidden_size),               "hidden dimension")
+    ("embedding", po::value<int>(&embedding_size)->default_value(embedding_size),         "embedding dimension")
+    ("beam",      po::value<int>(&beam_size)->default_value(beam_size),                   "beam size")
+    ("unary",     po::value<int>(&unary_size)->default_value(unary_size),                 "unary size")
+
+    ("debug", po::value<int>(&debug)->implicit_value(1), "debug level")
+
+    ("help", "help message");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc, po::command_line_style::unix_style & (~po::command_line_style::allow_guessing)), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << argv[0] << " [options]" << '\n' << desc << '\n';
+    exit(0);
+  }
+}
@@ -0,0 +1,115 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+//
+// convert a model into a single file binary model, or back into a model directory
+//
+
+#include <iostream>
+
+#include <trance/model_traits.hpp>
+
+#include "utils/resource.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+typedef boost::filesystem::path path_type;
+
+typedef trance::Model model_type;
+
+path_type model_file;
+path_type output_file;
+
+bool binary_mode = false;
+bool text_mode = false;
+
+int debug = 0;
+
+template <typename Theta>
+void convert(const path_type& input_path, const path_type& output_path);
+void options(int argc, char** argv);
+
+int main(int argc, char** argv)
+{
+  try {
+    options(argc, argv);
+
+    if (model_file.empty() || ! boost::filesystem::exists(model_file))
+      throw std::runtime_error("no model file? " + model_file.string());
+    if (output_file.empty())
+      throw std::runtime_error("no output file?");
+    if (boost::filesystem::exists(output_file) && boost::filesystem::equivalent(model_file, output_file))
+      throw std::runtime_error("the output overwrites the model: " + output_file.string());
+    if (binary_mode && text_mode)
+      throw std::runtime_error("either --binary or --text");
+
+    // by default, we convert into the other format
+    if (! binary_mode && ! text_mode)
+      binary_mode = ! model_type::model_file_type::exists(model_file);
+
+    switch (model_type::model(model_file)) {
+    case trance::model::MODEL1: convert<trance::model::Model1>(model_file, output_file); break;
+    case trance::model::MODEL2: convert<trance::model::Model2>(model_file, output_file); break;
+    case trance::model::MODEL3: convert<trance::model::Model3>(model_file, output_file); break;
+    case trance::model::MODEL4: convert<trance::model::Model4>(model_file, output_file); break;
+    case trance::model::MODEL5: convert<trance::model::Model5>(model_file, output_file); break;
+    default:
+      throw std::runtime_error("invalid model file");
+    }
+  }
+  catch (const std::exception& err) {
+    std::cerr << "error: " << err.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+template <typename Theta>
+void convert(const path_type& input_path, const path_type& output_path)
+{
+  utils::resource start;
+
+  Theta theta(input_path);
+
+  utils::resource loaded;
+
+  if (binary_mode)
+    theta.write_binary(output_path);
+  else
+    theta.write(output_path);
+
+  utils::resource end;
+
+  if (debug)
+    std::cerr << "read cpu time: " << loaded.cpu_time() - start.cpu_time()
+	      << " user time: " << loaded.user_time() - start.user_time() << std::endl
+	      << "write cpu time: " << end.cpu_time() - loaded.cpu_time()
+	      << " user time: " << end.user_time() - loaded.user_time() << std::endl;
+}
+
+void options(int argc, char** argv)
+{
+  namespace po = boost::program_options;
+
+  po::options_description desc("options");
+  desc.add_options()
+    ("model",  po::value<path_type>(&model_file),  "model file")
+    ("output", po::value<path_type>(&output_file), "output model file")
+    ("binary", po::bool_switch(&binary_mode),      "output a single file binary model (default for a model directory)")
+    ("text",   po::bool_switch(&text_mode),        "output a model directory (default for a binary model)")
+
+    ("debug", po::value<int>(&debug)->implicit_value(1), "debug level")
+
+    ("help", "help message");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc, po::command_line_style::unix_style & (~po::command_line_style::allow_guessing)), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << argv[0] << " [options]" << '\n' << desc << '\n';
+    exit(0);
+  }
+}
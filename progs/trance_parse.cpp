@@ -73,7 +73,23 @@ int beam_size = 64;
 int kbest_size = 1;
 int unary_size = 3;
 
+double beam_margin = 0.0;
+int beam_min = 1;
+int beam_max = 0;
+
+bool batch_mode = false;
+bool lazy_mode = false;
+bool recombine_mode = false;
+bool early_mode = false;
+int parallel_size = 1;
+
 bool precompute = false;
+double precompute_cache = 0;
+std::string precompute_publish;
+std::string precompute_attach;
+std::string precompute_remove;
+std::string quantize;
+bool pack = false;
 
 // this is for debugging purpose...
 bool randomize = false;
@@ -104,7 +120,19 @@ int main(int argc, char** argv)
       return 0;
     }
 
+    if (! precompute_remove.empty()) {
+      if (! model_type::precompute_type::remove(precompute_remove))
+	throw std::runtime_error("unable to remove shared memory: " + precompute_remove);
+      return 0;
+    }
+
+    if (! precompute_publish.empty() && ! precompute_attach.empty())
+      throw std::runtime_error("either one of --precompute-publish or --precompute-attach");
+    if (! precompute_attach.empty() && (precompute || precompute_cache > 0))
+      throw std::runtime_error("--precompute-attach with --precompute or --precompute-cache?");
+
     threads = utils::bithack::max(1, threads);
+    parallel_size = utils::bithack::max(1, parallel_size);
 
     if (beam_size <= 0)
       throw std::runtime_error("invalid beam size: " + utils::lexical_cast<std::string>(beam_size));
@@ -113,6 +141,17 @@ int main(int argc, char** argv)
     if (unary_size < 0)
       throw std::runtime_error("invalid unary size: " + utils::lexical_cast<std::string>(unary_size));
 
+    if (beam_margin < 0.0)
+      throw std::runtime_error("invalid beam margin: " + utils::lexical_cast<std::string>(beam_margin));
+    if (beam_max <= 0)
+      beam_max = beam_size;
+    if (beam_min <= 0 || beam_min > beam_max)
+      throw std::runtime_error("invalid beam range: " + utils::lexical_cast<std::string>(beam_min)
+			       + " " + utils::lexical_cast<std::string>(beam_max));
+
+    if (lazy_mode && recombine_mode)
+      throw std::runtime_error("--lazy does not recombine the candidates: either one of --lazy or --recombine");
+
     if (simple_mode && forest_mode)
       throw std::runtime_error("either one of --simple or --forest");
 
@@ -245,19 +284,21 @@ struct MapReduce
     id_type       id_;
     buffer_type   buffer_;
     resource_type resource_;
+    size_type     expanded_;
 
     id_buffer_type()
-      : id_(id_type(-1)), buffer_(), resource_() {}
+      : id_(id_type(-1)), buffer_(), resource_(), expanded_(0) {}
     id_buffer_type(const id_type& id, const buffer_type& buffer)
-      : id_(id), buffer_(buffer), resource_() {}
+      : id_(id), buffer_(buffer), resource_(), expanded_(0) {}
     id_buffer_type(const id_type& id, const buffer_type& buffer, const resource_type& resource)
-      : id_(id), buffer_(buffer), resource_(resource) {}
+      : id_(id), buffer_(buffer), resource_(resource), expanded_(0) {}
 
     void clear()
     {
       id_ = id_type(-1);
       buffer_.clear();
       resource_.clear();
+      expanded_ = 0;
     }
 
     void swap(id_buffer_type& x)
@@ -265,6 +306,7 @@ struct MapReduce
       std::swap(id_, x.id_);
       buffer_.swap(x.buffer_);
       std::swap(resource_, x.resource_);
+      std::swap(expanded_, x.expanded_);
     }
   };
 
@@ -314,7 +356,18 @@ struct Mapper : public MapReduce
     typedef parser_type::derivation_set_type derivation_set_type;
     typedef std::vector<char, std::allocator<char> > buf_type;
 
-    parser_type parser(beam_size, unary_size);
+    parser_type parser(beam_size, unary_size, early_mode);
+    
+    parser.beam_margin_ = beam_margin;
+    parser.beam_min_ = beam_min;
+    parser.beam_max_ = beam_max;
+    
+    parser.batch_ = batch_mode;
+    parser.lazy_ = lazy_mode;
+    parser.recombine_ = recombine_mode;
+    // the features of the derivations are output only by the default format
+    parser.materialize_ = ! simple_mode && ! forest_mode;
+    parser.threads_ = parallel_size;
 
     id_buffer_type mapped;
     id_buffer_type reduced;
@@ -332,6 +385,9 @@ struct Mapper : public MapReduce
 
       if (mapped.id_ == id_type(-1)) break;
 
+      // the unseen words of the sentence are released after the output
+      trance::SymbolScope scope;
+
       input.assign(mapped.buffer_);
 
       resource_type start;
@@ -343,6 +399,7 @@ struct Mapper : public MapReduce
       // output kbest derivations
       reduced.id_       = mapped.id_;
       reduced.resource_ = end - start;
+      reduced.expanded_ = parser.expanded_;
       reduced.buffer_.clear();
 
       buf.clear();
@@ -434,12 +491,18 @@ struct Reducer : public MapReduce
     resource_type resource;
     resource.clear();
 
+    size_type expanded = 0;
+
     for (;;) {
       reducer_.pop_swap(reduced);
 
       if (reduced.id_ == id_type(-1) && reduced.buffer_.empty()) break;
 
       resource += reduced.resource_;
+      expanded += reduced.expanded_;
+
+      if (debug >= 2)
+	std::cerr << "id: " << reduced.id_ << " expanded states: " << reduced.expanded_ << std::endl;
 
       bool dump = false;
 
@@ -488,6 +551,7 @@ struct Reducer : public MapReduce
 
     if (debug)
       std::cerr << "# of sentences: " << id
+		<< " expanded states: " << expanded
 		<< " user time: " << resource.user_time()
 		<< " thread time: " << resource.thread_time()
 		<< std::endl;
@@ -512,7 +576,7 @@ void parse(const grammar_type& grammar,
   if (! model_file.empty()) {
     utils::resource start;
 
-    theta.read(model_file);
+    theta.read(model_file, threads);
 
     utils::resource end;
 
@@ -533,10 +597,10 @@ void parse(const grammar_type& grammar,
       theta.embedding(embedding_file);
   }
 
-  if (precompute) {
+  if (precompute || precompute_cache > 0 || ! precompute_publish.empty()) {
     utils::resource start;
 
-    theta.precompute();
+    theta.precompute(precompute_cache > 0 && precompute_publish.empty() ? size_t(precompute_cache * 1024 * 1024) : size_t(0), threads);
 
     utils::resource end;
 
@@ -547,6 +611,93 @@ void parse(const grammar_type& grammar,
 		<< std::endl;
   }
 
+  // the loader publishes the precomputed columns, and does not parse
+  if (! precompute_publish.empty()) {
+    theta.publish(precompute_publish);
+
+    if (debug)
+      std::cerr << "published: " << precompute_publish
+		<< " columns: " << theta.cache_.statistics().columns_
+		<< " bytes: " << sizeof(model_type::parameter_type) * theta.cache_.rows() * theta.cache_.statistics().columns_
+		<< std::endl;
+    return;
+  }
+
+  if (! precompute_attach.empty()) {
+    utils::resource start;
+
+    theta.attach(precompute_attach);
+
+    utils::resource end;
+
+    if (debug)
+      std::cerr << "attached: " << precompute_attach
+		<< " columns: " << theta.cache_.statistics().columns_
+		<< " cpu time: " << end.cpu_time() - start.cpu_time()
+		<< " user time: " << end.user_time() - start.user_time()
+		<< std::endl;
+  }
+
+  if (! quantize.empty()) {
+    const model_type::quantized_type::precision_type precision = model_type::quantized_type::precision(quantize);
+
+    // we may already have the quantized weights converted by trance_quantize
+    if (theta.Qsh_.precision_ != precision) {
+      utils::resource start;
+
+      theta.quantize(precision);
+
+      utils::resource end;
+
+      if (debug)
+	std::cerr << "quantization:"
+		  << " cpu time: " << end.cpu_time() - start.cpu_time()
+		  << " user time: " << end.user_time() - start.user_time()
+		  << std::endl;
+    }
+  }
+
+  if (debug && ! theta.Qsh_.empty())
+    std::cerr << "quantized: " << model_type::quantized_type::name(theta.Qsh_.precision_)
+	      << " bytes: " << (theta.Qsh_.size_bytes() + theta.Qre_.size_bytes() + theta.Qu_.size_bytes())
+	      << " float bytes: " << (sizeof(model_type::parameter_type)
+				      * (theta.Qsh_.rows_ * theta.Qsh_.cols_
+					 + theta.Qre_.rows_ * theta.Qre_.cols_
+					 + theta.Qu_.rows_ * theta.Qu_.cols_))
+	      << std::endl;
+
+  if (debug && ! theta.Lsh_.empty())
+    std::cerr << "low-rank:"
+	      << " bytes: " << (theta.Lsh_.size_bytes() + theta.Lre_.size_bytes() + theta.Lu_.size_bytes())
+	      << " float bytes: " << (sizeof(model_type::parameter_type)
+				      * (theta.Lsh_.rows_ * theta.Lsh_.cols_
+					 + theta.Lre_.rows_ * theta.Lre_.cols_
+					 + theta.Lu_.rows_ * theta.Lu_.cols_))
+	      << std::endl;
+
+  // the float weights are not used by the quantized kernels, thus released. We keep the rows, by which the
+  // layers are addressed.
+  if (! theta.Qsh_.empty()) {
+    theta.Wsh_.resize(theta.Wsh_.rows(), 0);
+    theta.Wre_.resize(theta.Wre_.rows(), 0);
+    theta.Wu_.resize(theta.Wu_.rows(), 0);
+  }
+
+  if (pack && theta.Qsh_.empty()) {
+    utils::resource start;
+
+    theta.pack();
+
+    utils::resource end;
+
+    if (debug)
+      std::cerr << "packed:"
+		<< " bytes: " << (theta.Psh_.size_bytes() + theta.Pre_.size_bytes() + theta.Pu_.size_bytes())
+		<< " cpu time: " << end.cpu_time() - start.cpu_time()
+		<< " user time: " << end.user_time() - start.user_time()
+		<< std::endl;
+  }
+
   if (debug) {
     const size_t terminals = std::count(theta.vocab_terminal_.begin(), theta.vocab_terminal_.end(), true);
     const size_t non_terminals = (theta.vocab_category_.size()
@@ -558,6 +709,12 @@ void parse(const grammar_type& grammar,
 	      << std::endl;
   }
 
+  // the features are not output by the simple and the forest formats, thus the weights are folded into the
+  // scores of the feature functions
+  feature_set_type feats_folded(feats.clone());
+  if (simple_mode || forest_mode)
+    feats_folded.fold(theta.Wfe_);
+
   map_reduce_type::queue_type queue_mapper(threads);
   map_reduce_type::queue_type queue_reducer;
 
@@ -566,7 +723,7 @@ void parse(const grammar_type& grammar,
 
   boost::thread_group mappers;
   for (int i = 0; i != threads; ++ i)
-    mappers.add_thread(new boost::thread(mapper_type(grammar, signature, feats, theta, queue_mapper, queue_reducer)));
+    mappers.add_thread(new boost::thread(mapper_type(grammar, signature, feats_folded, theta, queue_mapper, queue_reducer)));
 
   map_reduce_type::id_buffer_type id_buffer;
   map_reduce_type::id_type id = 0;
@@ -589,6 +746,22 @@ void parse(const grammar_type& grammar,
   }
   mappers.join_all();
 
+  if (debug && theta.cache_.lazy()) {
+    const model_type::precompute_type::statistics_type statistics = theta.cache_.statistics();
+    const size_t lookups = statistics.hits_ + statistics.misses_;
+
+    std::cerr << "precompute cache:"
+	      << " hits: " << statistics.hits_
+	      << " misses: " << statistics.misses_
+	      << " evictions: " << statistics.evictions_
+	      << " columns: " << statistics.columns_
+	      << " hit rate: " << (lookups ? double(statistics.hits_) / lookups : 0.0)
+	      << std::endl;
+  }
+
+  if (debug)
+    std::cerr << "symbols: " << trance::Symbol::allocated() << std::endl;
+
   // terminate reducers
   id_buffer.clear();
   queue_reducer.push(id_buffer);
@@ -625,7 +798,22 @@ void options(int argc, char** argv)
     ("kbest", po::value<int>(&kbest_size)->default_value(kbest_size), "kbest size")
     ("unary", po::value<int>(&unary_size)->default_value(unary_size), "unary size")
 
+    ("beam-margin", po::value<double>(&beam_margin)->default_value(beam_margin), "adaptive beam by the score margin from the best state (0 for a fixed beam)")
+    ("beam-min",    po::value<int>(&beam_min)->default_value(beam_min),          "minimum beam size for the adaptive beam")
+    ("beam-max",    po::value<int>(&beam_max)->default_value(beam_max),          "maximum beam size for the adaptive beam (0 for the beam size)")
+
+    ("batch", po::bool_switch(&batch_mode), "batched beam expansion by matrix-matrix products")
+    ("lazy", po::bool_switch(&lazy_mode), "lazy expansion which materializes only the successors within the beam")
+    ("recombine", po::bool_switch(&recombine_mode), "approximate recombination of states with the same stack of labels and spans")
+    ("early", po::bool_switch(&early_mode), "early termination when the best finished state dominates the beam (only for kbest 1 without feature functions)")
+
     ("precompute",     po::bool_switch(&precompute),          "precompute word embedding")
+    ("precompute-cache", po::value<double>(&precompute_cache), "precompute word embedding on demand, cached up to the size in MB")
+    ("precompute-publish", po::value<std::string>(&precompute_publish), "precompute word embedding and publish only the precomputed columns to the named shared memory, then exit")
+    ("precompute-attach",  po::value<std::string>(&precompute_attach),  "attach to the precomputed columns in the named shared memory (the weights are still loaded by each process)")
+    ("precompute-remove",  po::value<std::string>(&precompute_remove),  "remove the named shared memory of the precomputed columns, then exit")
+    ("quantize",       po::value<std::string>(&quantize),     "quantized weights for shift/reduce/unary (int8, fp16 or none). By default, the quantized weights of the model, if any")
+    ("pack",           po::bool_switch(&pack),                "pack shift/reduce/unary by categories (ignored by the quantized weights)")
     ("randomize",      po::bool_switch(&randomize),           "randomize model parameters")
     ("word-embedding", po::value<path_type>(&embedding_file), "word embedding file");
 
@@ -633,6 +821,7 @@ void options(int argc, char** argv)
   opts_command.add_options()
     ("config",  po::value<path_type>(),                    "configuration file")
     ("threads", po::value<int>(&threads)->default_value(threads), "# of threads")
+    ("parallel", po::value<int>(&parallel_size)->default_value(parallel_size), "# of threads to expand each step within a sentence")
 
     ("feature-list", po::bool_switch(&feature_function_list), "list of feature functions")
 
@@ -28,6 +28,11 @@ namespace trance
   public:
     static const size_type chunk_size  = 1024 * 4;
     static const size_type chunk_mask  = chunk_size - 1;
+
+    // states are 32-byte aligned in the chunks aligned by the cache line, so that the leading fields of a state
+    // share a cache line
+    static const size_type state_align = 32;
+    static const size_type chunk_align = 64;
     
   public:
 
@@ -47,12 +52,9 @@ namespace trance
 	state_chunk_size_(0)
     {
       if (state_size_ != 0) {
-	// sizeof(char*) aligned size..
-	const size_type pointer_size = sizeof(pointer);
-	const size_type pointer_mask = ~(pointer_size - 1);
-      
-	state_alloc_size_ = (state_size_ + pointer_size - 1) & pointer_mask;
-	state_chunk_size_ = state_alloc_size_ * chunk_size;
+	// state_align aligned size..
+	state_alloc_size_ = (state_size_ + state_align - 1) & (~(state_align - 1));
+	state_chunk_size_ = state_alloc_size_ * chunk_size + chunk_align;
       }
     }
   
@@ -103,13 +105,14 @@ namespace trance
       }
     
       const size_type chunk_pos = state_iterator_ & chunk_mask;
+      const size_type chunk_id  = state_iterator_ / chunk_size;
     
-      if (chunk_pos == 0)
+      if (chunk_id == states_.size())
 	states_.push_back(allocator_type::allocate(state_chunk_size_));
     
       ++ state_iterator_;
     
-      return state_type(states_.back() + chunk_pos * state_alloc_size_);
+      return state_type(aligned(states_[chunk_id]) + chunk_pos * state_alloc_size_);
     }
   
     void deallocate(const state_type& state)
@@ -137,7 +140,14 @@ namespace trance
       if (state_size_ != __state_size)
 	*this = Allocator(__state_size);
       else
-	clear();
+	reset();
+    }
+    
+    // release all the states, but keep the chunks for the subsequent allocations
+    void reset()
+    {
+      state_iterator_ = 0;
+      cache_ = 0;
     }
   
     void clear()
@@ -151,6 +161,12 @@ namespace trance
       cache_ = 0;
     }
   
+  private:
+    static pointer aligned(pointer chunk)
+    {
+      return reinterpret_cast<pointer>((reinterpret_cast<size_t>(chunk) + chunk_align - 1) & (~(chunk_align - 1)));
+    }
+    
   private:  
     state_set_type states_;
     size_type state_iterator_;
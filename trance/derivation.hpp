@@ -108,7 +108,8 @@ namespace trance
   private:
     void assign(state_type state, tree_type& tree)
     {
-      features_ += *state.feature_vector();
+      if (state.feature_vector())
+	features_ += *state.feature_vector();
 
       switch (state.operation().operation()) {
       case operation_type::AXIOM:
@@ -4,6 +4,7 @@
 
 #include <utils/config.hpp>
 #include <utils/thread_specific_ptr.hpp>
+#include <utils/unordered_map.hpp>
 
 #include "feature.hpp"
 
@@ -12,6 +13,12 @@ namespace trance
   struct FeatureImpl
   {
     typedef Feature::feature_map_type feature_map_type;
+    typedef Feature::piece_type       piece_type;
+    typedef Feature::id_type          id_type;
+
+    // the keys refer to the strings of the global features, which are never moved
+    typedef utils::unordered_map<piece_type, id_type, boost::hash<piece_type>, std::equal_to<piece_type>,
+				 std::allocator<std::pair<const piece_type, id_type> > >::type index_cache_type;
   };
   
   Feature::ticket_type    Feature::__mutex;
@@ -43,4 +50,73 @@ namespace trance
     return *feature_maps;
 #endif
   }
+
+  // the owner is local to the function, since the features may be allocated during the static initialization
+  static FeatureImpl::index_cache_type& __index_cache()
+  {
+#ifdef HAVE_TLS
+    static __thread FeatureImpl::index_cache_type*                   cache_tls = 0;
+    static utils::thread_specific_ptr<FeatureImpl::index_cache_type> cache;
+    
+    if (! cache_tls) {
+      cache.reset(new FeatureImpl::index_cache_type());
+      cache_tls = cache.get();
+    }
+    
+    return *cache_tls;
+#else
+    static utils::thread_specific_ptr<FeatureImpl::index_cache_type> cache;
+    
+    if (! cache.get())
+      cache.reset(new FeatureImpl::index_cache_type());
+    
+    return *cache;
+#endif
+  }
+  
+  Feature::id_type Feature::__allocate(const piece_type& x)
+  {
+    FeatureImpl::index_cache_type& cache = __index_cache();
+    
+    FeatureImpl::index_cache_type::const_iterator citer = cache.find(x);
+    if (citer != cache.end())
+      return citer->second;
+    
+    id_type id = id_type(-1);
+    const feature_type* stored = 0;
+    
+    {
+      ticket_type::scoped_reader_lock lock(__mutex);
+      
+      const feature_index_type& index = __index();
+      
+      feature_index_type::const_iterator iter = index.find(x);
+      
+      if (iter != index.end()) {
+	id = iter - index.begin();
+	stored = &(__features()[id]);
+      }
+    }
+    
+    if (! stored) {
+      ticket_type::scoped_writer_lock lock(__mutex);
+      
+      feature_index_type& index = __index();
+      
+      std::pair<feature_index_type::iterator, bool> result = index.insert(x);
+      
+      if (result.second) {
+	feature_set_type& features = __features();
+	features.push_back(x);
+	const_cast<piece_type&>(*result.first) = features.back();
+      }
+      
+      id = result.first - index.begin();
+      stored = &(__features()[id]);
+    }
+    
+    cache.insert(std::make_pair(piece_type(*stored), id));
+    
+    return id;
+  }
 };
@@ -168,22 +168,9 @@ namespace trance
       return id_;
     }
     
-    static id_type __allocate(const piece_type& x)
-    {
-      ticket_type::scoped_writer_lock lock(__mutex);
-      
-      feature_index_type& index = __index();
-      
-      std::pair<feature_index_type::iterator, bool> result = index.insert(x);
-      
-      if (result.second) {
-	feature_set_type& features = __features();
-	features.push_back(x);
-	const_cast<piece_type&>(*result.first) = features.back();
-      }
-      
-      return result.first - index.begin();
-    }
+    // the features already seen by the thread are looked up without locking, then the global index by the reader
+    // lock, and only the new features are inserted by the writer lock
+    static id_type __allocate(const piece_type& x);
     
   private:
     id_type id_;
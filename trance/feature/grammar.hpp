@@ -50,6 +50,7 @@ namespace trance
 
       typedef feature_function_type::parameter_type parameter_type;
       typedef feature_function_type::feature_type   feature_type;
+      typedef feature_function_type::weights_type   weights_type;
 
       typedef std::vector<feature_type, std::allocator<feature_type> > name_set_type;
 
@@ -131,6 +132,20 @@ namespace trance
 
       typedef utils::mulvector2<parameter_type, std::allocator<parameter_type> > feature_map_type;
 
+      typedef std::vector<double, std::allocator<double> > score_set_type;
+
+      // the features of each rule folded by the weights, indexed as the rules
+      struct score_map_type
+      {
+	score_set_type unary_;
+	score_set_type binary_;
+	score_set_type preterminal_;
+
+	double unk_unary_;
+	double unk_binary_;
+	double unk_preterminal_;
+      };
+
       GrammarImpl(const path_type& path, const std::string& name)
       {
 	namespace qi = boost::spirit::qi;
@@ -197,6 +212,36 @@ namespace trance
 	name_preterminal_ = name + ":unk-preterminal";
       }
 
+      void fold(const weights_type& weights, score_map_type& scores) const
+      {
+	fold(weights, features_unary_,       scores.unary_);
+	fold(weights, features_binary_,      scores.binary_);
+	fold(weights, features_preterminal_, scores.preterminal_);
+
+	scores.unk_unary_       = - weights[name_unary_];
+	scores.unk_binary_      = - weights[name_binary_];
+	scores.unk_preterminal_ = - weights[name_preterminal_];
+      }
+
+    private:
+      void fold(const weights_type& weights, const feature_map_type& features, score_set_type& scores) const
+      {
+	typedef feature_map_type::const_reference feature_set_type;
+
+	scores.clear();
+	scores.reserve(features.size());
+
+	for (size_type id = 0; id != features.size(); ++ id) {
+	  double score = 0.0;
+
+	  name_set_type::const_iterator niter = names_.begin();
+	  feature_set_type::const_iterator fiter_end = features[id].end();
+	  for (feature_set_type::const_iterator fiter = features[id].begin(); fiter != fiter_end; ++ fiter, ++ niter)
+	    score += weights[*niter] * (*fiter);
+
+	  scores.push_back(score);
+	}
+      }
 
     public:
       unary_set_type       unary_;
@@ -225,6 +270,8 @@ namespace trance
 
       typedef GrammarImpl impl_type;
 
+      typedef boost::shared_ptr<const impl_type::score_map_type> score_map_ptr_type;
+
     public:
       Grammar(const std::string& name, const impl_type& impl, const signature_ptr_type& signature)
 	: FeatureFunction(name, sizeof(symbol_type)),
@@ -244,6 +291,20 @@ namespace trance
       }
 
 
+      // the folded scores are shared by the clones
+      virtual void fold(const weights_type& weights)
+      {
+	boost::shared_ptr<impl_type::score_map_type> scores(new impl_type::score_map_type());
+
+	pimpl_->fold(weights, *scores);
+
+	scores_ = scores;
+      }
+
+      virtual void unfold() { scores_.reset(); }
+
+      virtual bool folded() const { return scores_.get() != 0; }
+
       // feature application for axiom
       virtual void apply(const operation_type& operation,
 			 state_type state,
@@ -268,7 +329,12 @@ namespace trance
 	    iter = pimpl_->preterminal_.find(impl_type::preterminal_type(label, symbol_type::UNK));
 	}
 
-	if (iter != pimpl_->preterminal_.end()) {
+	if (scores_) {
+	  if (iter != pimpl_->preterminal_.end())
+	    features.score_ += scores_->preterminal_[iter - pimpl_->preterminal_.begin()];
+	  else
+	    features.score_ += scores_->unk_preterminal_;
+	} else if (iter != pimpl_->preterminal_.end()) {
 	  const size_type id =  iter - pimpl_->preterminal_.begin();
 
 	  typedef impl_type::feature_map_type::const_reference feature_set_type;
@@ -296,7 +362,12 @@ namespace trance
 
 	impl_type::binary_set_type::const_iterator iter = pimpl_->binary_.find(impl_type::binary_type(label, rhs0, rhs1));
 
-	if (iter != pimpl_->binary_.end()) {
+	if (scores_) {
+	  if (iter != pimpl_->binary_.end())
+	    features.score_ += scores_->binary_[iter - pimpl_->binary_.begin()];
+	  else
+	    features.score_ += scores_->unk_binary_;
+	} else if (iter != pimpl_->binary_.end()) {
 	  const size_type id =  iter - pimpl_->binary_.begin();
 
 	  typedef impl_type::feature_map_type::const_reference feature_set_type;
@@ -322,7 +393,12 @@ namespace trance
 
 	impl_type::unary_set_type::const_iterator iter = pimpl_->unary_.find(impl_type::unary_type(label, rhs));
 
-	if (iter != pimpl_->unary_.end()) {
+	if (scores_) {
+	  if (iter != pimpl_->unary_.end())
+	    features.score_ += scores_->unary_[iter - pimpl_->unary_.begin()];
+	  else
+	    features.score_ += scores_->unk_unary_;
+	} else if (iter != pimpl_->unary_.end()) {
 	  const size_type id =  iter - pimpl_->unary_.begin();
 
 	  typedef impl_type::feature_map_type::const_reference feature_set_type;
@@ -354,6 +430,7 @@ namespace trance
     private:
       const impl_type* pimpl_;
       signature_ptr_type signature_;
+      score_map_ptr_type scores_;
     };
 
     struct FactoryGrammar : public trance::FeatureFunctionFactory
@@ -0,0 +1,47 @@
+// -*- mode: c++ -*-
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#ifndef __TRANCE__FEATURE_BUFFER__HPP__
+#define __TRANCE__FEATURE_BUFFER__HPP__ 1
+
+//
+// features emitted by the feature functions for a successor
+//
+// The features are kept in a linear vector, which is reused across the successors. The feature functions
+// folded by the weights add their scores directly to score_, instead of emitting the features.
+//
+
+#include <trance/feature_vector_linear.hpp>
+
+namespace trance
+{
+  template <typename Tp, typename Alloc=std::allocator<Tp> >
+  class FeatureBuffer : public FeatureVectorLinear<Tp, Alloc>
+  {
+  public:
+    typedef FeatureVectorLinear<Tp, Alloc> vector_type;
+
+  public:
+    FeatureBuffer() : vector_type(), score_(0.0) {}
+
+  public:
+    void clear()
+    {
+      vector_type::clear();
+      score_ = 0.0;
+    }
+
+    void swap(FeatureBuffer& x)
+    {
+      vector_type::swap(x);
+      std::swap(score_, x.score_);
+    }
+
+  public:
+    double score_;
+  };
+};
+
+#endif
@@ -11,7 +11,7 @@
 #include <trance/operation.hpp>
 #include <trance/model.hpp>
 #include <trance/feature.hpp>
-#include <trance/feature_vector.hpp>
+#include <trance/feature_buffer.hpp>
 
 #include <boost/shared_ptr.hpp>
 
@@ -31,11 +31,13 @@ namespace trance
     typedef model_type::symbol_type    symbol_type;
     typedef model_type::word_type      word_type;    
     typedef model_type::parameter_type parameter_type;
+    typedef model_type::weights_type   weights_type;
     
     typedef Operation  operation_type;
     
     typedef Feature feature_type;
-    typedef FeatureVector<parameter_type, std::allocator<parameter_type> > feature_vector_type;
+    // features are emitted into a linear buffer, which is reused by the parser and scored by the feature ids
+    typedef FeatureBuffer<parameter_type, std::allocator<parameter_type> > feature_vector_type;
     
   public:
     typedef FeatureFunction feature_function_type;
@@ -53,6 +55,12 @@ namespace trance
     // cloning
     virtual feature_function_ptr_type clone() const = 0;
     
+    // fold the weights into the scores of the features, which are added to the score of the buffer instead of
+    // emitting the features. The scores are a snapshot of the weights, thus fold again after the weights are updated.
+    virtual void fold(const weights_type& weights) {}
+    virtual void unfold() {}
+    virtual bool folded() const { return false; }
+    
     // feature application for axiom
     virtual void apply(const operation_type& operation,
 		       state_type state,
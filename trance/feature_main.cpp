@@ -0,0 +1,164 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+// verify that the scores of the folded grammar features match the dot products of the unfolded features
+// by random weights, for every preterminal, unary and binary rule of the grammar, and for the unknown rules.
+
+#include <cmath>
+#include <string>
+#include <iostream>
+
+#include <boost/random.hpp>
+
+#include "grammar.hpp"
+#include "feature_set.hpp"
+#include "dot_product.hpp"
+
+typedef trance::FeatureSet feature_set_type;
+
+typedef feature_set_type::feature_type        feature_type;
+typedef feature_set_type::feature_vector_type feature_vector_type;
+typedef feature_set_type::weights_type        weights_type;
+typedef feature_set_type::operation_type      operation_type;
+typedef feature_set_type::symbol_type         symbol_type;
+typedef feature_set_type::state_type          state_type;
+
+struct Verify
+{
+  Verify(feature_set_type& feats, const weights_type& weights)
+    : feats_(feats), weights_(weights), checked_(0), failed_(0) {}
+
+  double score() const
+  {
+    return trance::dot_product(weights_, features_.begin(), features_.end(), features_.score_);
+  }
+
+  void check(const std::string& name, const double unfolded, const double folded)
+  {
+    ++ checked_;
+
+    if (std::fabs(unfolded - folded) > 1e-5 * (1 + std::fabs(unfolded))) {
+      ++ failed_;
+      std::cerr << name << " unfolded: " << unfolded << " folded: " << folded << std::endl;
+    }
+  }
+
+  // the features of the rule, by the shift of its children
+  double preterminal(const symbol_type& lhs, const symbol_type& word)
+  {
+    features_.clear();
+    feats_.deallocate(feats_.apply(operation_type::SHIFT, lhs, word, features_));
+
+    return score();
+  }
+
+  double unary(const symbol_type& lhs, const symbol_type& rhs)
+  {
+    const state_type state = feats_.apply(operation_type::SHIFT, rhs, symbol_type::EPSILON, features_);
+
+    features_.clear();
+    feats_.deallocate(feats_.apply(operation_type(operation_type::UNARY, 1), lhs, state, features_));
+    feats_.deallocate(state);
+
+    return score();
+  }
+
+  double binary(const symbol_type& lhs, const symbol_type& rhs0, const symbol_type& rhs1)
+  {
+    const state_type state_next = feats_.apply(operation_type::SHIFT, rhs0, symbol_type::EPSILON, features_);
+    const state_type state_top  = feats_.apply(operation_type::SHIFT, rhs1, symbol_type::EPSILON, features_);
+
+    features_.clear();
+    feats_.deallocate(feats_.apply(operation_type::REDUCE, lhs, state_top, state_next, features_));
+    feats_.deallocate(state_top);
+    feats_.deallocate(state_next);
+
+    return score();
+  }
+
+  template <typename Rule>
+  double apply(const Rule& rule)
+  {
+    if (rule.preterminal())
+      return preterminal(rule.lhs_, rule.rhs_.front());
+    else if (rule.unary())
+      return unary(rule.lhs_, rule.rhs_.front());
+    else
+      return binary(rule.lhs_, rule.rhs_.front(), rule.rhs_.back());
+  }
+
+  template <typename Rule>
+  void verify(const Rule& rule)
+  {
+    feats_.unfold();
+    const double unfolded = apply(rule);
+
+    feats_.fold(weights_);
+    const double folded = apply(rule);
+
+    check(rule.string(), unfolded, folded);
+  }
+
+  feature_set_type&   feats_;
+  const weights_type& weights_;
+  feature_vector_type features_;
+
+  size_t checked_;
+  size_t failed_;
+};
+
+int main(int argc, char** argv)
+{
+  if (argc != 2 && argc != 3) {
+    std::cerr << argv[0] << " grammar-file [signature]" << std::endl;
+    return 1;
+  }
+
+  trance::Grammar grammar(argv[1]);
+
+  feature_set_type feats;
+  feats.push_back("grammar:file=" + std::string(argv[1]) + ",signature=" + (argc == 3 ? argv[2] : "none"));
+  feats.initialize();
+
+  // the features are allocated by loading the grammar
+  boost::mt19937 gen;
+  gen.seed(1234);
+
+  weights_type weights;
+  for (size_t id = 0; id != feature_type::allocated(); ++ id)
+    weights[feature_type(id)] = boost::random::uniform_real_distribution<double>(-1, 1)(gen);
+
+  Verify verify(feats, weights);
+
+  trance::Grammar::rule_set_preterminal_type::const_iterator piter_end = grammar.preterminal_.end();
+  for (trance::Grammar::rule_set_preterminal_type::const_iterator piter = grammar.preterminal_.begin(); piter != piter_end; ++ piter) {
+    trance::Grammar::rule_set_type::const_iterator riter_end = piter->second.end();
+    for (trance::Grammar::rule_set_type::const_iterator riter = piter->second.begin(); riter != riter_end; ++ riter)
+      verify.verify(*riter);
+  }
+
+  trance::Grammar::rule_set_type::const_iterator uiter_end = grammar.unary_rules_.end();
+  for (trance::Grammar::rule_set_type::const_iterator uiter = grammar.unary_rules_.begin(); uiter != uiter_end; ++ uiter)
+    verify.verify(*uiter);
+
+  trance::Grammar::rule_set_type::const_iterator biter_end = grammar.binary_rules_.end();
+  for (trance::Grammar::rule_set_type::const_iterator biter = grammar.binary_rules_.begin(); biter != biter_end; ++ biter)
+    verify.verify(*biter);
+
+  // unknown rules by an unseen label, and an unseen word resolved by the signature or the unknown word
+  const symbol_type unseen("[unseen-label]");
+  const symbol_type word("unseen-word-of-the-grammar");
+
+  verify.verify(trance::Rule(unseen, trance::Rule::rhs_type(1, word)));
+  if (! grammar.pos_.empty())
+    verify.verify(trance::Rule(grammar.pos_.front(), trance::Rule::rhs_type(1, word)));
+  if (! grammar.non_terminal_.empty()) {
+    verify.verify(trance::Rule(unseen, trance::Rule::rhs_type(1, grammar.non_terminal_.front())));
+    verify.verify(trance::Rule(unseen, trance::Rule::rhs_type(2, grammar.non_terminal_.front())));
+  }
+
+  std::cerr << "checked: " << verify.checked_ << " failed: " << verify.failed_ << std::endl;
+
+  return verify.failed_ != 0;
+}
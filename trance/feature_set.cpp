@@ -3,6 +3,7 @@
 //
 
 #include <stdexcept>
+#include <algorithm>
 
 #include "trance/option.hpp"
 #include "trance/feature_set.hpp"
@@ -11,6 +12,7 @@
 #include "trance/feature/penalty.hpp"
 
 #include "utils/unordered_set.hpp"
+#include "utils/hashmurmur3.hpp"
 
 namespace trance
 {
@@ -120,6 +122,29 @@ namespace trance
     return state;
   }
 
+  size_t FeatureSet::hash(const state_type& state, size_t seed) const
+  {
+    if (! state) return seed;
+    
+    for (size_t i = 0; i != impl_.size(); ++ i)
+      if (impl_[i]->size_)
+	seed = utils::hashmurmur3<size_t>()(state.buffer_ + offsets_[i], impl_[i]->size_, seed);
+    
+    return seed;
+  }
+  
+  bool FeatureSet::equal(const state_type& x, const state_type& y) const
+  {
+    if (x == y) return true;
+    if (! x || ! y) return false;
+    
+    for (size_t i = 0; i != impl_.size(); ++ i)
+      if (! std::equal(x.buffer_ + offsets_[i], x.buffer_ + offsets_[i] + impl_[i]->size_, y.buffer_ + offsets_[i]))
+	return false;
+    
+    return true;
+  }
+  
   void FeatureSet::initialize()
   {
     typedef utils::unordered_set<feature_type, boost::hash<feature_type>, std::equal_to<std::string>,
@@ -149,6 +174,27 @@ namespace trance
     allocator_.assign(size_);
   }
 
+  
+  void FeatureSet::fold(const weights_type& weights)
+  {
+    for (size_t i = 0; i != impl_.size(); ++ i)
+      impl_[i]->fold(weights);
+  }
+  
+  void FeatureSet::unfold()
+  {
+    for (size_t i = 0; i != impl_.size(); ++ i)
+      impl_[i]->unfold();
+  }
+  
+  bool FeatureSet::folded() const
+  {
+    for (size_t i = 0; i != impl_.size(); ++ i)
+      if (impl_[i]->folded())
+	return true;
+    
+    return false;
+  }
 
   FeatureSet::feature_function_ptr_type FeatureSet::create(const utils::piece& param)
   {
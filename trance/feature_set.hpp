@@ -29,6 +29,7 @@ namespace trance
     typedef Model model_type;
     
     typedef model_type::parameter_type parameter_type;
+    typedef model_type::weights_type   weights_type;
     
     typedef FeatureFunction feature_function_type;
 
@@ -107,12 +108,21 @@ namespace trance
       allocator_.deallocate(state);
     }
     
+    // hash and equality of states by their contents, which exclude the paddings for the alignment
+    size_t hash(const state_type& state, size_t seed) const;
+    bool equal(const state_type& x, const state_type& y) const;
+    
   public:
     static feature_function_ptr_type create(const utils::piece& param);
     static std::string usage();
     
   public:
     void initialize();
+    
+    // fold the weights into the feature functions, used only when the features are not required
+    void fold(const weights_type& weights);
+    void unfold();
+    bool folded() const;
 
     void swap(FeatureSet& x)
     {
@@ -5,6 +5,9 @@
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/include/karma.hpp>
 
+#include <numeric>
+#include <algorithm>
+
 #include "grammar.hpp"
 
 #include "utils/compact_set.hpp"
@@ -149,6 +152,63 @@ namespace trance
       piter->second.insert(piter->second.end(), uniques.begin(), uniques.end());
       rule_set_type(piter->second).swap(piter->second);
     }
+
+    compile();
+  }
+
+  void Grammar::compile()
+  {
+    non_terminal_size_ = 0;
+    binary_rules_.clear();
+    binary_offsets_.clear();
+    unary_rules_.clear();
+    unary_offsets_.clear();
+
+    // the table size is the maximum non-terminal id of the children
+    size_type size = 0;
+
+    rule_set_binary_type::const_iterator biter_end = binary_.end();
+    for (rule_set_binary_type::const_iterator biter = binary_.begin(); biter != biter_end; ++ biter) {
+      if (! biter->first.first.non_terminal() || ! biter->first.second.non_terminal())
+	throw std::runtime_error("invalid binary rule: " + static_cast<const std::string&>(biter->first.first)
+				 + " " + static_cast<const std::string&>(biter->first.second));
+
+      size = utils::bithack::max(size, size_type(biter->first.first.non_terminal_id()) + 1);
+      size = utils::bithack::max(size, size_type(biter->first.second.non_terminal_id()) + 1);
+    }
+
+    rule_set_unary_type::const_iterator uiter_end = unary_.end();
+    for (rule_set_unary_type::const_iterator uiter = unary_.begin(); uiter != uiter_end; ++ uiter) {
+      if (! uiter->first.non_terminal())
+	throw std::runtime_error("invalid unary rule: " + static_cast<const std::string&>(uiter->first));
+
+      size = utils::bithack::max(size, size_type(uiter->first.non_terminal_id()) + 1);
+    }
+
+    non_terminal_size_ = size;
+
+    // count the rules, then place them
+    binary_offsets_.resize(size * size + 1, 0);
+    unary_offsets_.resize(size + 1, 0);
+
+    for (rule_set_binary_type::const_iterator biter = binary_.begin(); biter != biter_end; ++ biter)
+      binary_offsets_[biter->first.first.non_terminal_id() * size + biter->first.second.non_terminal_id() + 1] += biter->second.size();
+
+    for (rule_set_unary_type::const_iterator uiter = unary_.begin(); uiter != uiter_end; ++ uiter)
+      unary_offsets_[uiter->first.non_terminal_id() + 1] += uiter->second.size();
+
+    std::partial_sum(binary_offsets_.begin(), binary_offsets_.end(), binary_offsets_.begin());
+    std::partial_sum(unary_offsets_.begin(), unary_offsets_.end(), unary_offsets_.begin());
+
+    binary_rules_.resize(binary_offsets_.back());
+    unary_rules_.resize(unary_offsets_.back());
+
+    for (rule_set_binary_type::const_iterator biter = binary_.begin(); biter != biter_end; ++ biter)
+      std::copy(biter->second.begin(), biter->second.end(),
+		binary_rules_.begin() + binary_offsets_[biter->first.first.non_terminal_id() * size + biter->first.second.non_terminal_id()]);
+
+    for (rule_set_unary_type::const_iterator uiter = unary_.begin(); uiter != uiter_end; ++ uiter)
+      std::copy(uiter->second.begin(), uiter->second.end(), unary_rules_.begin() + unary_offsets_[uiter->first.non_terminal_id()]);
   }
 
   void Grammar::write(const path_type& path) const
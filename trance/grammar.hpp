@@ -6,6 +6,8 @@
 #ifndef __TRANCE__GRAMMAR__HPP__
 #define __TRANCE__GRAMMAR__HPP__ 1
 
+#include <stdint.h>
+
 #include <vector>
 
 #include <trance/symbol.hpp>
@@ -50,8 +52,29 @@ namespace trance
 				 boost::hash<word_type>, std::equal_to<word_type>,
 				 std::allocator<std::pair<const word_type, rule_set_type> > >::type rule_set_preterminal_type;
 
+    // a range of rules in the compiled rule array
+    struct rule_range_type
+    {
+      typedef const rule_type* const_iterator;
+      
+      rule_range_type() : first_(0), last_(0) {}
+      rule_range_type(const_iterator first, const_iterator last) : first_(first), last_(last) {}
+      
+      const_iterator begin() const { return first_; }
+      const_iterator end() const { return last_; }
+      
+      bool empty() const { return first_ == last_; }
+      size_type size() const { return last_ - first_; }
+      
+      const_iterator first_;
+      const_iterator last_;
+    };
+    
+    typedef uint32_t offset_type;
+    typedef std::vector<offset_type, std::allocator<offset_type> > offset_set_type;
+
   public:
-    Grammar() {}
+    Grammar() : non_terminal_size_(0) {}
     Grammar(const path_type& path) { read(path); }
     
   public:
@@ -63,6 +86,10 @@ namespace trance
     void read(const path_type& path);
     void write(const path_type& path) const;
 
+    // compile the binary and unary rules into the tables indexed by the non-terminal ids of the children.
+    // This is performed by read(), and should be performed again whenever binary_ or unary_ is modified.
+    void compile();
+
     void clear()
     {
       goal_               = symbol_type();
@@ -73,36 +100,63 @@ namespace trance
       unary_.clear();
       preterminal_.clear();
       
+      non_terminal_size_ = 0;
+      binary_rules_.clear();
+      binary_offsets_.clear();
+      unary_rules_.clear();
+      unary_offsets_.clear();
+      
       terminal_.clear();
       non_terminal_.clear();
       pos_.clear();
     }
 
-    const rule_set_type& binary(const symbol_type& left, const symbol_type& right) const
+    rule_range_type binary(const symbol_type& left, const symbol_type& right) const
     {
-      rule_set_binary_type::const_iterator biter = binary_.find(std::make_pair(left, right));
-      if (biter == binary_.end()) {
-	static const rule_set_type empty_;
-	return empty_;
-      } else
-	return biter->second;
+      const size_type id_left  = left.non_terminal_id();
+      const size_type id_right = right.non_terminal_id();
+      
+      if (id_left >= non_terminal_size_ || id_right >= non_terminal_size_)
+	return rule_range_type();
+      
+      const size_type index = id_left * non_terminal_size_ + id_right;
+      
+      return range(binary_rules_, binary_offsets_[index], binary_offsets_[index + 1]);
     }
     
-    const rule_set_type& unary(const symbol_type& symbol) const
+    rule_range_type unary(const symbol_type& symbol) const
+    {
+      const size_type id = symbol.non_terminal_id();
+      
+      if (id >= non_terminal_size_)
+	return rule_range_type();
+      
+      return range(unary_rules_, unary_offsets_[id], unary_offsets_[id + 1]);
+    }
+
+    const rule_set_type& preterminal(const signature_type& signature, const word_type& terminal) const
     {
-      rule_set_unary_type::const_iterator uiter = unary_.find(symbol);
-      if (uiter == unary_.end()) {
+      rule_set_preterminal_type::const_iterator piter = preterminal_.find(terminal);
+      if (piter == preterminal_.end()) {
+	piter = preterminal_.find(signature(terminal));
+	
+	if (piter == preterminal_.end())
+	  piter = preterminal_.find(symbol_type::UNK);
+      }
+      
+      if (piter == preterminal_.end()) {
 	static const rule_set_type empty_;
 	return empty_;
       } else
-	return uiter->second;
+	return piter->second;
     }
 
-    const rule_set_type& preterminal(const signature_type& signature, const word_type& terminal) const
+    // preterminal rules by the signature of the terminal computed beforehand
+    const rule_set_type& preterminal(const word_type& terminal, const word_type& signature) const
     {
       rule_set_preterminal_type::const_iterator piter = preterminal_.find(terminal);
       if (piter == preterminal_.end()) {
-	piter = preterminal_.find(signature(terminal));
+	piter = preterminal_.find(signature);
 	
 	if (piter == preterminal_.end())
 	  piter = preterminal_.find(symbol_type::UNK);
@@ -115,6 +169,12 @@ namespace trance
 	return piter->second;
     }
     
+  private:
+    static rule_range_type range(const rule_set_type& rules, const offset_type first, const offset_type last)
+    {
+      return (first == last ? rule_range_type() : rule_range_type(&rules[first], &rules[first] + (last - first)));
+    }
+    
   public:
     // goal
     symbol_type goal_;
@@ -130,6 +190,15 @@ namespace trance
     label_set_type terminal_;
     label_set_type non_terminal_;
     label_set_type pos_;
+
+    // compiled rule set: the binary rules of the children (left, right) are
+    // binary_rules_[binary_offsets_[left * non_terminal_size_ + right], binary_offsets_[left * non_terminal_size_ + right + 1]),
+    // and the unary rules of the child are unary_rules_[unary_offsets_[child], unary_offsets_[child + 1])
+    size_type       non_terminal_size_;
+    rule_set_type   binary_rules_;
+    offset_set_type binary_offsets_;
+    rule_set_type   unary_rules_;
+    offset_set_type unary_offsets_;
   };
 };
 
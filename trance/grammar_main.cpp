@@ -33,7 +33,7 @@ int main(int argc, char** argv)
   trance::Symbol symbol;
   while (std::cin >> symbol) {
     if (symbol.non_terminal()) {
-      const trance::Grammar::rule_set_type& rules = grammar.unary(symbol);
+      const trance::Grammar::rule_range_type rules = grammar.unary(symbol);
       
       if (rules.empty()) 
 	std::cout << "no rule..." << std::endl;
@@ -0,0 +1,73 @@
+// -*- mode: c++ -*-
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#ifndef __TRANCE__LATTICE__HPP__
+#define __TRANCE__LATTICE__HPP__ 1
+
+//
+// lexical lattice of a sentence
+//
+// For each position of the input, the signature of the word, the terminal id of the word in the model and
+// the preterminal rules of the grammar. They are computed once before the search, so that the states in
+// the beam look them up by positions.
+//
+
+#include <vector>
+
+#include <trance/symbol.hpp>
+#include <trance/sentence.hpp>
+#include <trance/grammar.hpp>
+#include <trance/signature.hpp>
+
+namespace trance
+{
+  struct Lattice
+  {
+    typedef size_t    size_type;
+    typedef ptrdiff_t difference_type;
+
+    typedef Symbol    word_type;
+    typedef Sentence  sentence_type;
+    typedef Grammar   grammar_type;
+    typedef Signature signature_type;
+
+    typedef grammar_type::rule_set_type rule_set_type;
+
+    typedef std::vector<word_type, std::allocator<word_type> >                       signature_set_type;
+    typedef std::vector<word_type::id_type, std::allocator<word_type::id_type> >     terminal_set_type;
+    typedef std::vector<const rule_set_type*, std::allocator<const rule_set_type*> > preterminal_set_type;
+
+    template <typename Theta>
+    void assign(const sentence_type& input,
+		const grammar_type& grammar,
+		const signature_type& signature,
+		const Theta& theta)
+    {
+      clear();
+
+      for (size_type i = 0; i != input.size(); ++ i) {
+	signatures_.push_back(signature(input[i]));
+	terminals_.push_back(theta.terminal(input[i]));
+	preterminals_.push_back(&grammar.preterminal(input[i], signatures_.back()));
+      }
+    }
+
+    size_type size() const { return terminals_.size(); }
+    bool empty() const { return terminals_.empty(); }
+
+    void clear()
+    {
+      signatures_.clear();
+      terminals_.clear();
+      preterminals_.clear();
+    }
+
+    signature_set_type   signatures_;
+    terminal_set_type    terminals_;
+    preterminal_set_type preterminals_;
+  };
+};
+
+#endif
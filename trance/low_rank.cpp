@@ -0,0 +1,192 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "low_rank.hpp"
+
+#include <Eigen/SVD>
+
+#include <boost/filesystem/operations.hpp>
+
+#include "utils/compress_stream.hpp"
+#include "utils/bithack.hpp"
+
+namespace trance
+{
+  typedef std::vector<LowRank::tensor_type, std::allocator<LowRank::tensor_type> > low_rank_tensor_set_type;
+
+  static
+  void low_rank_assign(const low_rank_tensor_set_type& lefts,
+		       const low_rank_tensor_set_type& rights,
+		       LowRank& low_rank)
+  {
+    typedef LowRank::size_type size_type;
+
+    low_rank.offsets_.clear();
+    low_rank.offsets_.resize(lefts.size() + 1, 0);
+
+    for (size_type i = 0; i != lefts.size(); ++ i)
+      low_rank.offsets_[i + 1] = low_rank.offsets_[i] + lefts[i].cols();
+
+    low_rank.left_.resize(low_rank.block_, low_rank.offsets_.back());
+    low_rank.right_.resize(low_rank.cols_, low_rank.offsets_.back());
+
+    for (size_type i = 0; i != lefts.size(); ++ i)
+      if (lefts[i].cols()) {
+	low_rank.left_.block(0, low_rank.offsets_[i], low_rank.block_, lefts[i].cols()) = lefts[i];
+	low_rank.right_.block(0, low_rank.offsets_[i], low_rank.cols_, rights[i].cols()) = rights[i];
+      }
+  }
+
+  void LowRank::assign(const tensor_type& matrix, const size_type block, const size_type rank, const double energy)
+  {
+    typedef Eigen::JacobiSVD<tensor_type> svd_type;
+
+    clear();
+
+    if (! block || matrix.rows() % block != 0)
+      throw std::runtime_error("rows does not match");
+    if (energy <= 0.0 || energy > 1.0)
+      throw std::runtime_error("energy should be in (0, 1]");
+
+    const size_type blocks = matrix.rows() / block;
+    const size_type cols   = matrix.cols();
+    const size_type limit  = utils::bithack::min(utils::bithack::min(rank ? rank : block, rank_max),
+						 utils::bithack::min(block, cols));
+
+    low_rank_tensor_set_type lefts(blocks);
+    low_rank_tensor_set_type rights(blocks);
+
+    for (size_type i = 0; i != blocks; ++ i) {
+      svd_type svd(matrix.block(block * i, 0, block, cols), Eigen::ComputeThinU | Eigen::ComputeThinV);
+
+      const svd_type::SingularValuesType& singular = svd.singularValues();
+
+      const double total = singular.squaredNorm();
+
+      size_type r = 0;
+      double kept = 0.0;
+      for (/**/; r != limit && kept < energy * total; ++ r)
+	kept += double(singular[r]) * singular[r];
+
+      lefts[i]  = svd.matrixU().leftCols(r) * singular.head(r).asDiagonal();
+      rights[i] = svd.matrixV().leftCols(r);
+    }
+
+    block_ = block;
+    rows_  = matrix.rows();
+    cols_  = cols;
+
+    low_rank_assign(lefts, rights, *this);
+  }
+
+  void LowRank::accumulate(const size_type row,
+			   const size_type col,
+			   const size_type rows,
+			   const size_type cols,
+			   const parameter_type* x,
+			   parameter_type* y) const
+  {
+    typedef Eigen::Matrix<parameter_type, Eigen::Dynamic, 1>                       vector_type;
+    typedef Eigen::Matrix<parameter_type, Eigen::Dynamic, 1, 0, rank_max, 1> buffer_type;
+
+    const size_type index = row / block_;
+    const size_type first = offsets_[index];
+    const size_type rank  = offsets_[index + 1] - first;
+
+    if (! rank) return;
+
+    buffer_type projected(rank);
+
+    projected.noalias() = right_.block(col, first, cols, rank).transpose() * Eigen::Map<const vector_type>(x, cols);
+
+    Eigen::Map<vector_type>(y, rows).noalias() += left_.block(row % block_, first, rows, rank) * projected;
+  }
+
+  void LowRank::write(const path_type& path,
+		      const category_set_type& categories) const
+  {
+    const size_type num_labels = utils::bithack::min(categories.size(), static_cast<size_type>(offsets_.size() - 1));
+
+    utils::compress_ostream os(path, 1024 * 1024);
+
+    os.write((char*) &cols_, sizeof(size_type));
+    os.write((char*) &block_, sizeof(size_type));
+
+    for (size_type i = 0; i != num_labels; ++ i)
+      if (categories[i] != category_type()) {
+	const size_type label_size = categories[i].size();
+	const size_type rank       = offsets_[i + 1] - offsets_[i];
+
+	os.write((char*) &label_size, sizeof(size_type));
+	os.write((char*) &(*categories[i].begin()), label_size);
+	os.write((char*) &rank, sizeof(size_type));
+
+	if (rank) {
+	  os.write((char*) left_.col(offsets_[i]).data(),  sizeof(parameter_type) * block_ * rank);
+	  os.write((char*) right_.col(offsets_[i]).data(), sizeof(parameter_type) * cols_ * rank);
+	}
+      }
+  }
+
+  void LowRank::read(const path_type& path,
+		     const size_type rows,
+		     const size_type cols,
+		     const size_type block)
+  {
+    clear();
+
+    if (path != "-" && ! boost::filesystem::exists(path))
+      throw std::runtime_error("no low-rank matrix: " + path.string());
+    if (! block || rows % block != 0)
+      throw std::runtime_error("rows does not match");
+
+    utils::compress_istream is(path, 1024 * 1024);
+
+    size_type cols_file  = 0;
+    size_type block_file = 0;
+
+    is.read((char*) &cols_file,  sizeof(size_type));
+    is.read((char*) &block_file, sizeof(size_type));
+
+    if (cols_file != cols || block_file != block)
+      throw std::runtime_error("low-rank matrix does not match: " + path.string());
+
+    low_rank_tensor_set_type lefts(rows / block);
+    low_rank_tensor_set_type rights(rows / block);
+
+    std::string label;
+    size_type label_size = 0;
+    size_type rank = 0;
+
+    while (is.read((char*) &label_size, sizeof(size_type))) {
+      label.resize(label_size);
+      is.read((char*) &(*label.begin()), label_size);
+      is.read((char*) &rank, sizeof(size_type));
+
+      const size_type index = category_type(label).non_terminal_id();
+
+      if (index >= lefts.size())
+	throw std::runtime_error("invalid category in low-rank matrix: " + label);
+      if (rank > utils::bithack::min(block, cols) || rank > rank_max)
+	throw std::runtime_error("invalid rank in low-rank matrix: " + label);
+
+      lefts[index].resize(block, rank);
+      rights[index].resize(cols, rank);
+
+      if (rank) {
+	is.read((char*) lefts[index].data(),  sizeof(parameter_type) * block * rank);
+	is.read((char*) rights[index].data(), sizeof(parameter_type) * cols * rank);
+      }
+    }
+
+    block_ = block;
+    rows_  = rows;
+    cols_  = cols;
+
+    low_rank_assign(lefts, rights, *this);
+  }
+};
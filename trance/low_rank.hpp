@@ -0,0 +1,141 @@
+// -*- mode: c++ -*-
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#ifndef __TRANCE__LOW_RANK__HPP__
+#define __TRANCE__LOW_RANK__HPP__ 1
+
+//
+// low-rank weights for inference
+//
+// Each category block of rows is factorized by the truncated SVD, W_c ~= U_c V_c^T, where the
+// rank of each category is the smallest one which keeps the given fraction of the squared singular
+// values, up to the given rank. Rare categories, which are barely trained, end up with small ranks.
+// The factors of all the categories are placed side by side: U_c is block x rank_c and V_c is
+// cols x rank_c, both contiguous.
+//
+
+#include <vector>
+
+#include <trance/symbol.hpp>
+
+#include <Eigen/Core>
+
+#include <boost/filesystem/path.hpp>
+
+namespace trance
+{
+  class LowRank
+  {
+  public:
+    typedef size_t    size_type;
+    typedef ptrdiff_t difference_type;
+    typedef float     parameter_type;
+
+    typedef Symbol symbol_type;
+    typedef symbol_type category_type;
+
+    typedef boost::filesystem::path path_type;
+
+    typedef Eigen::Matrix<parameter_type, Eigen::Dynamic, Eigen::Dynamic> tensor_type;
+    typedef Eigen::Block<const tensor_type>                               block_type;
+
+    typedef std::vector<category_type, std::allocator<category_type> > category_set_type;
+    typedef std::vector<size_type, std::allocator<size_type> >         offset_set_type;
+
+    // the intermediate V_c^T x is kept on the stack
+    static const size_type rank_max = 512;
+
+  public:
+    LowRank() : block_(0), rows_(0), cols_(0) {}
+
+  public:
+    // factorize the matrix by the blocks of rows
+    void assign(const tensor_type& matrix, const size_type block, const size_type rank, const double energy);
+
+    // y += W.block(row, col, rows, cols) * x, where the rows do not cross a category block
+    void accumulate(const size_type row,
+		    const size_type col,
+		    const size_type rows,
+		    const size_type cols,
+		    const parameter_type* x,
+		    parameter_type* y) const;
+
+    // IO by the category blocks of rows, similar to Quantized
+    void write(const path_type& path,
+	       const category_set_type& categories) const;
+    void read(const path_type& path,
+	      const size_type rows,
+	      const size_type cols,
+	      const size_type block);
+
+  public:
+    // rank of the category block of the row
+    size_type rank(const size_type row) const
+    {
+      const size_type index = row / block_;
+      return offsets_[index + 1] - offsets_[index];
+    }
+
+    // U_c and V_c for the category block of the row
+    block_type left(const size_type row) const
+    {
+      const size_type index = row / block_;
+      return left_.block(0, offsets_[index], block_, offsets_[index + 1] - offsets_[index]);
+    }
+
+    block_type right(const size_type row) const
+    {
+      const size_type index = row / block_;
+      return right_.block(0, offsets_[index], cols_, offsets_[index + 1] - offsets_[index]);
+    }
+
+  public:
+    bool empty() const { return rows_ == 0; }
+
+    size_type size_bytes() const { return (left_.size() + right_.size()) * sizeof(parameter_type); }
+
+    void clear()
+    {
+      block_ = 0;
+      rows_ = 0;
+      cols_ = 0;
+
+      offsets_.clear();
+      left_.resize(0, 0);
+      right_.resize(0, 0);
+    }
+
+    void swap(LowRank& x)
+    {
+      std::swap(block_, x.block_);
+      std::swap(rows_, x.rows_);
+      std::swap(cols_, x.cols_);
+
+      offsets_.swap(x.offsets_);
+      left_.swap(x.left_);
+      right_.swap(x.right_);
+    }
+
+  public:
+    size_type block_;
+    size_type rows_;
+    size_type cols_;
+
+    offset_set_type offsets_;
+    tensor_type     left_;
+    tensor_type     right_;
+  };
+};
+
+namespace std
+{
+  inline
+  void swap(trance::LowRank& x, trance::LowRank& y)
+  {
+    x.swap(y);
+  }
+};
+
+#endif
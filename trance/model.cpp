@@ -15,6 +15,9 @@
 
 #include "model.hpp"
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include "utils/compress_stream.hpp"
 #include "utils/repository.hpp"
 
@@ -27,6 +30,10 @@ namespace trance
 
     typedef utils::repository repository_type;
 
+    const model_type binary = model_file_type::model(path);
+    if (binary != model::NONE)
+      return binary;
+
     if (! repository_type::exists(path))
       return model::NONE;
 
@@ -560,6 +567,385 @@ namespace trance
     is.read((char*) matrix.data(), sizeof(tensor_type::Scalar) * rows * cols);
   }
 
+  Model::reader_type Model::reader_embedding(const path_type& path_txt,
+					     const path_type& path_bin,
+					     tensor_type& matrix)
+  {
+    typedef void (Model::*read_type)(const path_type&, const path_type&, tensor_type&);
+
+    return boost::bind(static_cast<read_type>(&Model::read_embedding), _1, path_txt, path_bin, boost::ref(matrix));
+  }
+
+  Model::reader_type Model::reader_weights(const path_type& path,
+					   weights_type& weights)
+  {
+    typedef void (Model::*read_type)(const path_type&, weights_type&);
+
+    return boost::bind(static_cast<read_type>(&Model::read_weights), _1, path, boost::ref(weights));
+  }
+
+  Model::reader_type Model::reader_category(const path_type& path_txt,
+					    const path_type& path_bin,
+					    tensor_type& matrix,
+					    const size_type rows,
+					    const size_type cols)
+  {
+    typedef void (Model::*read_type)(const path_type&, const path_type&, tensor_type&, const size_type, const size_type);
+
+    return boost::bind(static_cast<read_type>(&Model::read_category), _1, path_txt, path_bin, boost::ref(matrix), rows, cols);
+  }
+
+  Model::reader_type Model::reader_matrix(const path_type& path_txt,
+					  const path_type& path_bin,
+					  tensor_type& matrix)
+  {
+    typedef void (Model::*read_type)(const path_type&, const path_type&, tensor_type&);
+
+    return boost::bind(static_cast<read_type>(&Model::read_matrix), _1, path_txt, path_bin, boost::ref(matrix));
+  }
+
+  struct ModelReader
+  {
+    typedef Model::size_type       size_type;
+    typedef Model::reader_set_type reader_set_type;
+
+    typedef std::vector<Model, std::allocator<Model> > model_set_type;
+
+    ModelReader(const reader_set_type& readers,
+		model_set_type& models,
+		size_type& next,
+		std::string& error,
+		boost::mutex& mutex)
+      : readers_(readers), models_(models), next_(next), error_(error), mutex_(mutex) {}
+
+    void operator()()
+    {
+      for (;;) {
+	size_type pos = 0;
+
+	{
+	  boost::mutex::scoped_lock lock(mutex_);
+
+	  if (next_ == readers_.size() || ! error_.empty()) return;
+
+	  pos = next_;
+	  ++ next_;
+	}
+
+	try {
+	  readers_[pos](models_[pos]);
+	}
+	catch (const std::exception& err) {
+	  boost::mutex::scoped_lock lock(mutex_);
+
+	  if (error_.empty())
+	    error_ = err.what();
+	}
+      }
+    }
+
+    const reader_set_type& readers_;
+    model_set_type&        models_;
+    size_type&             next_;
+    std::string&           error_;
+    boost::mutex&          mutex_;
+  };
+
+  void Model::read(const reader_set_type& readers, const size_type threads)
+  {
+    typedef ModelReader reader_type;
+
+    const size_type num_threads = utils::bithack::min(threads, readers.size());
+
+    if (num_threads <= 1) {
+      for (size_type i = 0; i != readers.size(); ++ i)
+	readers[i](*this);
+      return;
+    }
+
+    reader_type::model_set_type models(readers.size(), Model(hidden_, embedding_));
+
+    size_type    next = 0;
+    std::string  error;
+    boost::mutex mutex;
+
+    boost::thread_group workers;
+    for (size_type i = 0; i != num_threads; ++ i)
+      workers.add_thread(new boost::thread(reader_type(readers, models, next, error, mutex)));
+    workers.join_all();
+
+    if (! error.empty())
+      throw std::runtime_error(error);
+
+    // merge vocabularies
+    for (size_type i = 0; i != models.size(); ++ i) {
+      const terminal_set_type& terminals  = models[i].vocab_terminal_;
+      const category_set_type& categories = models[i].vocab_category_;
+
+      if (terminals.size() > vocab_terminal_.size())
+	vocab_terminal_.resize(terminals.size(), false);
+      if (categories.size() > vocab_category_.size())
+	vocab_category_.resize(categories.size(), category_type());
+
+      for (size_type id = 0; id != terminals.size(); ++ id)
+	if (terminals[id])
+	  vocab_terminal_[id] = true;
+
+      for (size_type id = 0; id != categories.size(); ++ id)
+	if (categories[id] != category_type())
+	  vocab_category_[id] = categories[id];
+    }
+  }
+
+  void Model::concurrent(const size_type size, const size_type threads, const range_type& task)
+  {
+    const size_type num_threads = utils::bithack::max(size_type(1), utils::bithack::min(threads, size));
+
+    if (num_threads == 1) {
+      task(0, size);
+      return;
+    }
+
+    boost::thread_group workers;
+    for (size_type i = 0; i != num_threads; ++ i)
+      workers.add_thread(new boost::thread(task, size * i / num_threads, size * (i + 1) / num_threads));
+    workers.join_all();
+  }
+
+  bool Model::verify(const precompute_type& cache,
+		     const boost::function<void (const word_type::id_type&, parameter_type*)>& compute) const
+  {
+    const size_type samples = 16;
+    const size_type stride  = utils::bithack::max(size_type(1), vocab_terminal_.size() / samples);
+
+    tensor_type computed(cache.rows(), 1);
+    tensor_type cached(cache.rows(), 1);
+
+    for (size_type id = 0; id < vocab_terminal_.size(); id += stride)
+      if (vocab_terminal_[id]) {
+	if (! cache.find(id, cached.data()))
+	  return false;
+
+	compute(id, computed.data());
+
+	if ((computed - cached).cwiseAbs().maxCoeff() > 1e-4 * (1 + computed.cwiseAbs().maxCoeff()))
+	  return false;
+      }
+
+    return true;
+  }
+
+  void Model::write_embedding(model_file_type& file,
+			      const tensor_type& matrix) const
+  {
+    const size_type rows = matrix.rows();
+    const size_type cols = utils::bithack::min(static_cast<size_type>(matrix.cols()), vocab_terminal_.size());
+    const size_type num_words = std::count(vocab_terminal_.begin(), vocab_terminal_.begin() + cols, true);
+
+    file.write(uint64_t(rows));
+    file.write(uint64_t(num_words));
+
+    for (word_type::id_type id = 0; id != cols; ++ id)
+      if (vocab_terminal_[id])
+	file.write(utils::piece(word_type(id).symbol()));
+
+    // the columns are stored contiguously
+    tensor_type columns(rows, num_words);
+
+    size_type pos = 0;
+    for (word_type::id_type id = 0; id != cols; ++ id)
+      if (vocab_terminal_[id]) {
+	columns.col(pos) = matrix.col(id);
+	++ pos;
+      }
+
+    file.write(columns.data(), sizeof(tensor_type::Scalar) * rows * num_words);
+  }
+
+  void Model::read_embedding(model_file_type& file,
+			     tensor_type& matrix)
+  {
+    typedef std::vector<word_type::id_type, std::allocator<word_type::id_type> > id_set_type;
+
+    uint64_t rows      = 0;
+    uint64_t num_words = 0;
+    file.read(rows);
+    file.read(num_words);
+
+    id_set_type ids(num_words);
+    word_type::id_type id_max = matrix.cols();
+
+    for (size_type i = 0; i != num_words; ++ i) {
+      ids[i] = word_type(file.read_symbol()).id();
+      id_max = utils::bithack::max(id_max, ids[i] + 1);
+    }
+
+    if (matrix.rows() != rows || matrix.cols() != id_max) {
+      const tensor_type::Index cols = (matrix.rows() == rows ? matrix.cols() : 0);
+
+      matrix.conservativeResize(rows, id_max);
+      matrix.block(0, cols, rows, id_max - cols).setZero();
+    }
+    if (id_max > vocab_terminal_.size())
+      vocab_terminal_.resize(id_max, false);
+
+    // the columns are stored contiguously
+    tensor_type columns(rows, num_words);
+
+    file.read(columns.data(), sizeof(tensor_type::Scalar) * rows * num_words);
+
+    for (size_type i = 0; i != num_words; ++ i) {
+      matrix.col(ids[i]) = columns.col(i);
+
+      vocab_terminal_[ids[i]] = true;
+    }
+  }
+
+  void Model::write_weights(model_file_type& file,
+			    const weights_type& weights) const
+  {
+    const size_type size = weights.size();
+
+    file.write(uint64_t(size));
+
+    for (feature_type::id_type id = 0; id != size; ++ id)
+      file.write(utils::piece(feature_type(id).feature()));
+
+    file.write(size ? &(*weights.begin()) : 0, sizeof(parameter_type) * size);
+  }
+
+  void Model::read_weights(model_file_type& file,
+			   weights_type& weights)
+  {
+    typedef std::vector<feature_type, std::allocator<feature_type> > feature_set_type;
+
+    weights.clear();
+
+    uint64_t size = 0;
+    file.read(size);
+
+    feature_set_type features(size);
+
+    for (size_type i = 0; i != size; ++ i)
+      features[i] = feature_type(file.read_symbol());
+
+    std::vector<parameter_type, std::allocator<parameter_type> > values(size);
+
+    file.read(size ? &(*values.begin()) : 0, sizeof(parameter_type) * size);
+
+    for (size_type i = 0; i != size; ++ i)
+      weights[features[i]] = values[i];
+  }
+
+  void Model::write_category(model_file_type& file,
+			     const tensor_type& matrix,
+			     const size_type rows,
+			     const size_type cols) const
+  {
+    if (cols != matrix.cols())
+      throw std::runtime_error("column does not match");
+    if (matrix.rows() % rows != 0)
+      throw std::runtime_error("rows does not match");
+
+    const size_type label_max = utils::bithack::min(vocab_category_.size(), static_cast<size_type>(matrix.rows() / rows));
+
+    size_type num_labels = 0;
+    for (size_type id = 0; id != label_max; ++ id)
+      num_labels += (vocab_category_[id] != category_type());
+
+    file.write(uint64_t(rows));
+    file.write(uint64_t(cols));
+    file.write(uint64_t(num_labels));
+
+    for (size_type id = 0; id != label_max; ++ id)
+      if (vocab_category_[id] != category_type())
+	file.write(utils::piece(vocab_category_[id].symbol()));
+
+    // each block is stored contiguously by columns
+    tensor_type block(rows, cols);
+
+    for (size_type id = 0; id != label_max; ++ id)
+      if (vocab_category_[id] != category_type()) {
+	block = matrix.block(rows * id, 0, rows, cols);
+
+	file.write(block.data(), sizeof(tensor_type::Scalar) * rows * cols);
+      }
+  }
+
+  void Model::read_category(model_file_type& file,
+			    tensor_type& matrix,
+			    const size_type rows_hint,
+			    const size_type cols_hint)
+  {
+    typedef std::vector<category_type, std::allocator<category_type> > label_set_type;
+
+    uint64_t rows       = 0;
+    uint64_t cols       = 0;
+    uint64_t num_labels = 0;
+
+    file.read(rows);
+    file.read(cols);
+    file.read(num_labels);
+
+    if (rows != rows_hint)
+      throw std::runtime_error("invlaid rows for read category");
+    if (cols != cols_hint)
+      throw std::runtime_error("invlaid cols for read category");
+
+    label_set_type labels(num_labels);
+    size_type label_max = matrix.rows() / rows;
+
+    for (size_type i = 0; i != num_labels; ++ i) {
+      labels[i] = category_type(file.read_symbol());
+      label_max = utils::bithack::max(label_max, static_cast<size_type>(labels[i].non_terminal_id() + 1));
+    }
+
+    if (matrix.cols() != cols || matrix.rows() != rows * label_max) {
+      const tensor_type::Index rows_prev = (matrix.cols() == cols ? matrix.rows() : 0);
+
+      matrix.conservativeResize(rows * label_max, cols);
+      matrix.block(rows_prev, 0, rows * label_max - rows_prev, cols).setZero();
+    }
+    if (label_max > vocab_category_.size())
+      vocab_category_.resize(label_max, category_type());
+
+    // each block is stored contiguously by columns
+    tensor_type block(rows, cols);
+
+    for (size_type i = 0; i != num_labels; ++ i) {
+      const word_type::id_type label_id = labels[i].non_terminal_id();
+
+      file.read(block.data(), sizeof(tensor_type::Scalar) * rows * cols);
+
+      matrix.block(rows * label_id, 0, rows, cols) = block;
+
+      vocab_category_[label_id] = labels[i];
+    }
+  }
+
+  void Model::write_matrix(model_file_type& file,
+			   const tensor_type& matrix) const
+  {
+    file.write(uint64_t(matrix.rows()));
+    file.write(uint64_t(matrix.cols()));
+
+    file.write(matrix.data(), sizeof(tensor_type::Scalar) * matrix.rows() * matrix.cols());
+  }
+
+  void Model::read_matrix(model_file_type& file,
+			  tensor_type& matrix)
+  {
+    uint64_t rows = 0;
+    uint64_t cols = 0;
+
+    file.read(rows);
+    file.read(cols);
+
+    matrix.resize(rows, cols);
+
+    file.read(matrix.data(), sizeof(tensor_type::Scalar) * rows * cols);
+  }
+
   Model::tensor_type& Model::plus_equal(tensor_type& x, const tensor_type& y)
   {
     if (x.rows() == y.rows() && x.cols() == y.cols())
@@ -16,6 +16,11 @@
 #include <trance/signature.hpp>
 #include <trance/weight_vector.hpp>
 #include <trance/operation.hpp>
+#include <trance/quantized.hpp>
+#include <trance/packed.hpp>
+#include <trance/low_rank.hpp>
+#include <trance/precompute.hpp>
+#include <trance/model_file.hpp>
 
 #include <trance/model/model_type.hpp>
 
@@ -24,6 +29,7 @@
 #include <Eigen/Core>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
 
 namespace trance
 {
@@ -51,8 +57,18 @@ namespace trance
 
     typedef WeightVector<parameter_type, std::allocator<parameter_type> > weights_type;
 
+    typedef Quantized  quantized_type;
+    typedef Packed     packed_type;
+    typedef LowRank    low_rank_type;
+    typedef Precompute precompute_type;
+    typedef ModelFile  model_file_type;
+
     typedef symbol_type category_type;
     
+    typedef boost::function<void (Model&)>                                 reader_type;
+    typedef std::vector<reader_type, std::allocator<reader_type> >         reader_set_type;
+    typedef boost::function<void (const size_type, const size_type)>      range_type;
+
     typedef std::vector<bool, std::allocator<bool> >                   terminal_set_type;
     typedef std::vector<category_type, std::allocator<category_type> > category_set_type;
 
@@ -191,6 +207,98 @@ namespace trance
     void read_matrix(std::istream& is,
 		     tensor_type& matrix);
 
+    // readers of the path based interface, run by read()
+    static reader_type reader_embedding(const path_type& path_txt,
+					const path_type& path_bin,
+					tensor_type& matrix);
+    static reader_type reader_weights(const path_type& path,
+				      weights_type& weights);
+    static reader_type reader_category(const path_type& path_txt,
+				       const path_type& path_bin,
+				       tensor_type& matrix,
+				       const size_type rows,
+				       const size_type cols);
+    static reader_type reader_matrix(const path_type& path_txt,
+				     const path_type& path_bin,
+				     tensor_type& matrix);
+
+    // run the readers by at most threads. Each reader updates its own vocabulary, merged
+    // after all the readers are finished.
+    void read(const reader_set_type& readers, const size_type threads);
+
+    // run the task over the ranges of [0, size) split by threads
+    static void concurrent(const size_type size, const size_type threads, const range_type& task);
+
+    // single file binary model interface
+    void write_embedding(model_file_type& file,
+			 const tensor_type& matrix) const;
+    void read_embedding(model_file_type& file,
+			tensor_type& matrix);
+
+    void write_weights(model_file_type& file,
+		       const weights_type& weights) const;
+    void read_weights(model_file_type& file,
+		      weights_type& weights);
+    
+    void write_category(model_file_type& file,
+			const tensor_type& matrix,
+			const size_type rows,
+			const size_type cols) const;
+    void read_category(model_file_type& file,
+		       tensor_type& matrix,
+		       const size_type rows,
+		       const size_type cols);
+    
+    void write_matrix(model_file_type& file,
+		      const tensor_type& matrix) const;
+    void read_matrix(model_file_type& file,
+		     tensor_type& matrix);
+
+  public:
+    // precompute the terms which depend only on the word, bias + weights * embedding, for the columns
+    // of the terminal embedding, stored from the row offset of the cache.
+    // The embedding part of the weights starts from the column col.
+    template <typename Terminal>
+    static void precompute(adapted_type cache,
+			   const size_type offset,
+			   const Terminal& terminal,
+			   const tensor_type& weights,
+			   const tensor_type& bias,
+			   const size_type col)
+    {
+      cache.block(offset, 0, weights.rows(), terminal.cols()).noalias()
+	= weights.block(0, col, weights.rows(), terminal.rows()) * terminal;
+      cache.block(offset, 0, weights.rows(), terminal.cols()).colwise() += bias.col(0);
+    }
+
+    // precompute by the quantized weights, if any, since the float weights may be released once quantized.
+    // The quantized weights have no matrix-matrix kernel, thus the columns are accumulated one by one.
+    template <typename Terminal>
+    static void precompute(adapted_type cache,
+			   const size_type offset,
+			   const Terminal& terminal,
+			   const tensor_type& weights,
+			   const quantized_type& quantized,
+			   const tensor_type& bias,
+			   const size_type col)
+    {
+      if (quantized.empty()) {
+	precompute(cache, offset, terminal, weights, bias, col);
+	return;
+      }
+      
+      cache.block(offset, 0, quantized.rows_, terminal.cols()).setZero();
+      
+      for (difference_type i = 0; i != terminal.cols(); ++ i)
+	quantized.accumulate(0, col, quantized.rows_, terminal.rows(), terminal.col(i).data(), cache.col(i).data() + offset);
+      
+      cache.block(offset, 0, quantized.rows_, terminal.cols()).colwise() += bias.col(0);
+    }
+
+    // verify the precomputed columns of sampled words against the columns computed by compute
+    bool verify(const precompute_type& cache,
+		const boost::function<void (const word_type::id_type&, parameter_type*)>& compute) const;
+
   public:
     tensor_type& plus_equal(tensor_type& x, const tensor_type& y);
     tensor_type& minus_equal(tensor_type& x, const tensor_type& y);
@@ -32,7 +32,11 @@ namespace trance
       
       // IO
       void write(const path_type& path) const;
-      void read(const path_type& path);
+      void read(const path_type& path, const size_type threads=1);
+      
+      // single file binary model
+      void write_binary(const path_type& path) const;
+      void read_binary(const path_type& path);
       void embedding(const path_type& path);
     
       friend
@@ -46,6 +50,11 @@ namespace trance
       Model2& operator/=(const double& x);
     
     private:
+      template <typename Terminal>
+      void __precompute(adapted_type cache, const Terminal& terminal) const;
+      void __precompute_range(tensor_type& columns, const size_type first, const size_type last) const;
+      void __precompute_column(const word_type::id_type& id, parameter_type* column) const;
+
       template <typename Gen>
       struct __randomize
       {
@@ -73,7 +82,19 @@ namespace trance
 	const double range_f  = std::sqrt(6.0 / (hidden_ + hidden_));
 	const double range_i  = std::sqrt(6.0 / (hidden_ + hidden_));
 	
-	cache_.resize(0, 0);
+	cache_.clear();
+
+	Qsh_.clear();
+	Qre_.clear();
+	Qu_.clear();
+
+	Psh_.clear();
+	Pre_.clear();
+	Pu_.clear();
+
+	Lsh_.clear();
+	Lre_.clear();
+	Lu_.clear();
 
 	terminal_ = terminal_.array().unaryExpr(__randomize<Gen>(gen, range_embed));
       
@@ -94,6 +115,18 @@ namespace trance
 	Model::swap(static_cast<Model&>(x));
 
 	cache_.swap(x.cache_);
+
+	Qsh_.swap(x.Qsh_);
+	Qre_.swap(x.Qre_);
+	Qu_.swap(x.Qu_);
+
+	Psh_.swap(x.Psh_);
+	Pre_.swap(x.Pre_);
+	Pu_.swap(x.Pu_);
+
+	Lsh_.swap(x.Lsh_);
+	Lre_.swap(x.Lre_);
+	Lu_.swap(x.Lu_);
 	
 	terminal_.swap(x.terminal_);
       
@@ -123,7 +156,19 @@ namespace trance
       {
 	Model::clear();
 
-	cache_.resize(0, 0);
+	cache_.clear();
+
+	Qsh_.clear();
+	Qre_.clear();
+	Qu_.clear();
+
+	Psh_.clear();
+	Pre_.clear();
+	Pu_.clear();
+
+	Lsh_.clear();
+	Lre_.clear();
+	Lu_.clear();
 
 	terminal_.setZero();
       
@@ -182,11 +227,32 @@ namespace trance
 	return std::sqrt(norm);
       }
 
-      void precompute();
+      void precompute(const size_type capacity=0, const size_type threads=1);
+      void publish(const std::string& name) const;
+      void attach(const std::string& name);
+      void precompute(const word_type::id_type& id, parameter_type* column) const;
+      void quantize(const quantized_type::precision_type& precision);
+      void pack();
+      void compress(const size_type rank, const double energy);
       
     public:
-      // cache
-      tensor_type cache_;
+      // precomputed terms of words
+      precompute_type cache_;
+
+      // quantized weights for shift, reduce and unary
+      quantized_type Qsh_;
+      quantized_type Qre_;
+      quantized_type Qu_;
+
+      // shift, reduce and unary packed by categories
+      packed_type Psh_;
+      packed_type Pre_;
+      packed_type Pu_;
+
+      // shift, reduce and unary by low-rank factors
+      low_rank_type Lsh_;
+      low_rank_type Lre_;
+      low_rank_type Lu_;
       
       // terminal embedding
       tensor_type terminal_;
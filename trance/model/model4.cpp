@@ -11,6 +11,7 @@
 #include <boost/spirit/include/phoenix_core.hpp>
 
 #include <boost/fusion/tuple.hpp>
+#include <boost/bind.hpp>
 
 #include "model/model4.hpp"
 
@@ -22,15 +23,83 @@ namespace trance
 {
   namespace model
   {
-    void Model4::precompute()
+    template <typename Terminal>
+    void Model4::__precompute(adapted_type cache, const Terminal& terminal) const
     {
-      cache_ = tensor_type::Zero(hidden_ * vocab_category_.size(), terminal_.cols());
+      // the shift with its bias
+      Model::precompute(cache, 0, terminal, Wsh_, Qsh_, Bsh_, hidden_);
+    }
+
+    void Model4::__precompute_range(tensor_type& columns, const size_type first, const size_type last) const
+    {
+      __precompute(adapted_type(columns.col(first).data(), columns.rows(), last - first),
+		   terminal_.block(0, first, terminal_.rows(), last - first));
+    }
+
+    void Model4::__precompute_column(const word_type::id_type& id, parameter_type* column) const
+    {
+      __precompute(adapted_type(column, cache_.rows(), 1), terminal_.col(id));
+    }
+
+    void Model4::precompute(const size_type capacity, const size_type threads)
+    {
+      const size_type rows = Wsh_.rows();
 
-      const size_type id_max = terminal_.cols();
+      if (capacity)
+	cache_.assign(rows, terminal_.cols(), capacity);
+      else {
+	tensor_type columns(rows, terminal_.cols());
 
-      for (size_type id = 0; id != id_max; ++ id)
-	for (size_type c = 0; c != vocab_category_.size(); ++ c)
-	  cache_.block(c * hidden_, id, hidden_, 1) = Wsh_.block(c * hidden_, hidden_, hidden_, embedding_) * terminal_.col(id);
+	// split by the range of the vocabulary
+	Model::concurrent(terminal_.cols(), threads, boost::bind(&Model4::__precompute_range, this, boost::ref(columns), _1, _2));
+
+	cache_.assign(columns);
+      }
+    }
+
+    void Model4::publish(const std::string& name) const
+    {
+      cache_.publish(name, vocab_terminal_);
+    }
+
+    void Model4::attach(const std::string& name)
+    {
+      cache_.attach(name, Wsh_.rows());
+
+      if (! Model::verify(cache_, boost::bind(&Model4::__precompute_column, this, _1, _2))) {
+	cache_.clear();
+	throw std::runtime_error("shared memory does not match the model: " + name);
+      }
+    }
+
+    void Model4::precompute(const word_type::id_type& id, parameter_type* column) const
+    {
+      if (cache_.find(id, column)) return;
+
+      __precompute_column(id, column);
+
+      cache_.insert(id, column);
+    }
+
+    void Model4::quantize(const quantized_type::precision_type& precision)
+    {
+      Qsh_.assign(Wsh_, precision);
+      Qre_.assign(Wre_, precision);
+      Qu_.assign(Wu_, precision);
+    }
+
+    void Model4::pack()
+    {
+      Psh_.assign(Wsh_, hidden_);
+      Pre_.assign(Wre_, hidden_);
+      Pu_.assign(Wu_, hidden_);
+    }
+
+    void Model4::compress(const size_type rank, const double energy)
+    {
+      Lsh_.assign(Wsh_, hidden_, rank, energy);
+      Lre_.assign(Wre_, hidden_, rank, energy);
+      Lu_.assign(Wu_, hidden_, rank, energy);
     }
 
     void Model4::initialize(const size_type& hidden,
@@ -40,7 +109,19 @@ namespace trance
       Model::initialize(hidden, embedding, grammar);
 
       // initialize matrix
-      cache_.resize(0, 0);
+      cache_.clear();
+
+      Qsh_.clear();
+      Qre_.clear();
+      Qu_.clear();
+
+      Psh_.clear();
+      Pre_.clear();
+      Pu_.clear();
+
+      Lsh_.clear();
+      Lre_.clear();
+      Lu_.clear();
 
       terminal_ = tensor_type::Zero(embedding_, vocab_terminal_.size());
 
@@ -99,6 +180,24 @@ namespace trance
       Model::write_matrix(rep.path("Bi.txt.gz"), rep.path("Bi.bin"), Bi_);
 
       Model::write_matrix(rep.path("Ba.txt.gz"), rep.path("Ba.bin"), Ba_);
+
+      if (! Qsh_.empty()) {
+	const std::string name = quantized_type::name(Qsh_.precision_);
+
+	rep["quantize"] = name;
+
+	Qsh_.write(rep.path("Wsh." + name + ".bin"), vocab_category_, hidden_);
+	Qre_.write(rep.path("Wre." + name + ".bin"), vocab_category_, hidden_);
+	Qu_.write(rep.path("Wu."   + name + ".bin"), vocab_category_, hidden_);
+      }
+
+      if (! Lsh_.empty()) {
+	rep["low-rank"] = "true";
+
+	Lsh_.write(rep.path("Wsh.low-rank.bin"), vocab_category_);
+	Lre_.write(rep.path("Wre.low-rank.bin"), vocab_category_);
+	Lu_.write(rep.path("Wu.low-rank.bin"),   vocab_category_);
+      }
     }
 
     template <typename Value>
@@ -111,13 +210,18 @@ namespace trance
       return utils::lexical_cast<Value>(iter->second);
     }
 
-    void Model4::read(const path_type& path)
+    void Model4::read(const path_type& path, const size_type threads)
     {
       typedef utils::repository repository_type;
 
       if (path.empty() || ! boost::filesystem::exists(path))
 	throw std::runtime_error("no file? " + path.string());
 
+      if (model_file_type::exists(path)) {
+	read_binary(path);
+	return;
+      }
+
       repository_type rep(path, repository_type::read);
 
       if (repository_value<std::string>(rep, "model") != "model4")
@@ -135,7 +239,19 @@ namespace trance
       vocab_category_.clear();
 
       // first, resize
-      cache_.resize(0, 0);
+      cache_.clear();
+
+      Qsh_.clear();
+      Qre_.clear();
+      Qu_.clear();
+
+      Psh_.clear();
+      Pre_.clear();
+      Pu_.clear();
+
+      Lsh_.clear();
+      Lre_.clear();
+      Lu_.clear();
 
       terminal_ = tensor_type::Zero(embedding_, terminal_.cols());
 
@@ -161,28 +277,50 @@ namespace trance
       Ba_ = tensor_type::Zero(hidden_, 1);
 
       // then, read!
-      Model::read_embedding(rep.path("terminal.txt.gz"), rep.path("terminal.bin"), terminal_);
+      reader_set_type readers;
+
+      readers.push_back(Model::reader_embedding(rep.path("terminal.txt.gz"), rep.path("terminal.bin"), terminal_));
+
+      readers.push_back(Model::reader_category(rep.path("Wc.txt.gz"), rep.path("Wc.bin"),  Wc_,  1, hidden_ * 3));
+      readers.push_back(Model::reader_category(rep.path("Bc.txt.gz"), rep.path("Bc.bin"),  Bc_,  1, 3));
+      readers.push_back(Model::reader_weights(rep.path("Wfe.txt.gz"), Wfe_));
+
+      readers.push_back(Model::reader_category(rep.path("Wsh.txt.gz"), rep.path("Wsh.bin"), Wsh_, hidden_, hidden_ + embedding_));
+      readers.push_back(Model::reader_category(rep.path("Bsh.txt.gz"), rep.path("Bsh.bin"), Bsh_, hidden_, 1));
 
-      Model::read_category(rep.path("Wc.txt.gz"), rep.path("Wc.bin"),  Wc_,  1, hidden_ * 3);
-      Model::read_category(rep.path("Bc.txt.gz"), rep.path("Bc.bin"),  Bc_,  1, 3);
-      Model::read_weights(rep.path("Wfe.txt.gz"), Wfe_);
+      readers.push_back(Model::reader_category(rep.path("Wre.txt.gz"), rep.path("Wre.bin"), Wre_, hidden_, hidden_ + hidden_ + hidden_));
+      readers.push_back(Model::reader_category(rep.path("Bre.txt.gz"), rep.path("Bre.bin"), Bre_, hidden_, 1));
 
-      Model::read_category(rep.path("Wsh.txt.gz"), rep.path("Wsh.bin"), Wsh_, hidden_, hidden_ + embedding_);
-      Model::read_category(rep.path("Bsh.txt.gz"), rep.path("Bsh.bin"), Bsh_, hidden_, 1);
+      readers.push_back(Model::reader_category(rep.path("Wu.txt.gz"),  rep.path("Wu.bin"),  Wu_, hidden_, hidden_ + hidden_));
+      readers.push_back(Model::reader_category(rep.path("Bu.txt.gz"),  rep.path("Bu.bin"),  Bu_, hidden_, 1));
 
-      Model::read_category(rep.path("Wre.txt.gz"), rep.path("Wre.bin"), Wre_, hidden_, hidden_ + hidden_ + hidden_);
-      Model::read_category(rep.path("Bre.txt.gz"), rep.path("Bre.bin"), Bre_, hidden_, 1);
+      readers.push_back(Model::reader_matrix(rep.path("Wf.txt.gz"), rep.path("Wf.bin"), Wf_));
+      readers.push_back(Model::reader_matrix(rep.path("Bf.txt.gz"), rep.path("Bf.bin"), Bf_));
 
-      Model::read_category(rep.path("Wu.txt.gz"),  rep.path("Wu.bin"),  Wu_, hidden_, hidden_ + hidden_);
-      Model::read_category(rep.path("Bu.txt.gz"),  rep.path("Bu.bin"),  Bu_, hidden_, 1);
+      readers.push_back(Model::reader_matrix(rep.path("Wi.txt.gz"), rep.path("Wi.bin"), Wi_));
+      readers.push_back(Model::reader_matrix(rep.path("Bi.txt.gz"), rep.path("Bi.bin"), Bi_));
 
-      Model::read_matrix(rep.path("Wf.txt.gz"), rep.path("Wf.bin"), Wf_);
-      Model::read_matrix(rep.path("Bf.txt.gz"), rep.path("Bf.bin"), Bf_);
+      readers.push_back(Model::reader_matrix(rep.path("Ba.txt.gz"), rep.path("Ba.bin"), Ba_));
 
-      Model::read_matrix(rep.path("Wi.txt.gz"), rep.path("Wi.bin"), Wi_);
-      Model::read_matrix(rep.path("Bi.txt.gz"), rep.path("Bi.bin"), Bi_);
+      Model::read(readers, threads);
 
-      Model::read_matrix(rep.path("Ba.txt.gz"), rep.path("Ba.bin"), Ba_);
+      // quantized weights converted by trance_quantize
+      repository_type::const_iterator qiter = rep.find("quantize");
+      if (qiter != rep.end()) {
+	const std::string& name = qiter->second;
+	const quantized_type::precision_type precision = quantized_type::precision(name);
+
+	Qsh_.read(rep.path("Wsh." + name + ".bin"), precision, Wsh_.rows(), Wsh_.cols(), hidden_);
+	Qre_.read(rep.path("Wre." + name + ".bin"), precision, Wre_.rows(), Wre_.cols(), hidden_);
+	Qu_.read(rep.path("Wu."   + name + ".bin"), precision, Wu_.rows(),  Wu_.cols(),  hidden_);
+      }
+
+      // low-rank weights converted by trance_compress
+      if (rep.find("low-rank") != rep.end()) {
+	Lsh_.read(rep.path("Wsh.low-rank.bin"), Wsh_.rows(), Wsh_.cols(), hidden_);
+	Lre_.read(rep.path("Wre.low-rank.bin"), Wre_.rows(), Wre_.cols(), hidden_);
+	Lu_.read(rep.path("Wu.low-rank.bin"),   Wu_.rows(),  Wu_.cols(),  hidden_);
+      }
     }
 
     void Model4::embedding(const path_type& path)
@@ -277,11 +415,62 @@ namespace trance
 
       MODEL_STREAM_OPERATOR(theta, read_embedding, read_category, read_weights, read_matrix, is);
 
-      theta.cache_.resize(0, 0);
+      theta.cache_.clear();
+
+      theta.Qsh_.clear();
+      theta.Qre_.clear();
+      theta.Qu_.clear();
+
+      theta.Psh_.clear();
+      theta.Pre_.clear();
+      theta.Pu_.clear();
+
+      theta.Lsh_.clear();
+      theta.Lre_.clear();
+      theta.Lu_.clear();
 
       return is;
     }
 
+    void Model4::write_binary(const path_type& path) const
+    {
+      model_file_type file(path, model_file_type::WRITE);
+
+      file.write_header(model::MODEL4, hidden_, embedding_);
+
+      MODEL_STREAM_OPERATOR((*this), write_embedding, write_category, write_weights, write_matrix, file);
+
+      file.close();
+    }
+
+    void Model4::read_binary(const path_type& path)
+    {
+      model_file_type file(path, model_file_type::READ);
+
+      // we keep the sizes of the matrices, as in read()
+      Model4 theta;
+      theta.swap(*this);
+      theta.clear();
+
+      theta.vocab_terminal_.clear();
+      theta.vocab_category_.clear();
+
+      model_type model = model::NONE;
+
+      file.read_header(model, theta.hidden_, theta.embedding_);
+
+      if (model != model::MODEL4)
+	throw std::runtime_error("this is not model4!");
+      if (theta.hidden_ == 0)
+	throw std::runtime_error("invalid dimension");
+      if (theta.embedding_ == 0)
+	throw std::runtime_error("invalid dimension");
+
+      MODEL_STREAM_OPERATOR(theta, read_embedding, read_category, read_weights, read_matrix, file);
+
+      swap(theta);
+    }
+
 #undef MODEL_STREAM_OPERATOR
 
 #define MODEL_BINARY_OPERATOR(Op, Theta)	\
@@ -312,7 +501,19 @@ namespace trance
     {
       MODEL_BINARY_OPERATOR(Model::plus_equal, theta);
 
-      cache_.resize(0, 0);
+      cache_.clear();
+
+      Qsh_.clear();
+      Qre_.clear();
+      Qu_.clear();
+
+      Psh_.clear();
+      Pre_.clear();
+      Pu_.clear();
+
+      Lsh_.clear();
+      Lre_.clear();
+      Lu_.clear();
 
       return *this;
     }
@@ -321,7 +522,19 @@ namespace trance
     {
       MODEL_BINARY_OPERATOR(Model::minus_equal, theta);
 
-      cache_.resize(0, 0);
+      cache_.clear();
+
+      Qsh_.clear();
+      Qre_.clear();
+      Qu_.clear();
+
+      Psh_.clear();
+      Pre_.clear();
+      Pu_.clear();
+
+      Lsh_.clear();
+      Lre_.clear();
+      Lu_.clear();
 
       return *this;
     }
@@ -356,7 +569,19 @@ namespace trance
     {
       MODEL_UNARY_OPERATOR(*=);
 
-      cache_.resize(0, 0);
+      cache_.clear();
+
+      Qsh_.clear();
+      Qre_.clear();
+      Qu_.clear();
+
+      Psh_.clear();
+      Pre_.clear();
+      Pu_.clear();
+
+      Lsh_.clear();
+      Lre_.clear();
+      Lu_.clear();
 
       return *this;
     }
@@ -365,7 +590,19 @@ namespace trance
     {
       MODEL_UNARY_OPERATOR(/=);
 
-      cache_.resize(0, 0);
+      cache_.clear();
+
+      Qsh_.clear();
+      Qre_.clear();
+      Qu_.clear();
+
+      Psh_.clear();
+      Pre_.clear();
+      Pu_.clear();
+
+      Lsh_.clear();
+      Lre_.clear();
+      Lu_.clear();
 
       return *this;
     }
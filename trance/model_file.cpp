@@ -0,0 +1,176 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#include <cstring>
+#include <stdexcept>
+
+#include "model_file.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+namespace trance
+{
+  static const char model_file_magic[8] = {'T', 'R', 'A', 'N', 'C', 'E', 'B', 'M'};
+
+  bool ModelFile::exists(const path_type& path)
+  {
+    return model(path) != model::NONE;
+  }
+
+  ModelFile::model_type ModelFile::model(const path_type& path)
+  {
+    if (! boost::filesystem::is_regular_file(path))
+      return model::NONE;
+
+    std::ifstream is(path.string().c_str(), std::ios::binary);
+
+    char     magic[sizeof(model_file_magic)];
+    uint64_t header[2];
+
+    if (! is.read(magic, sizeof(magic)) || ! is.read((char*) header, sizeof(header)))
+      return model::NONE;
+    if (std::memcmp(magic, model_file_magic, sizeof(magic)) != 0 || header[0] != version)
+      return model::NONE;
+
+    switch (header[1]) {
+    case 1: return model::MODEL1;
+    case 2: return model::MODEL2;
+    case 3: return model::MODEL3;
+    case 4: return model::MODEL4;
+    case 5: return model::MODEL5;
+    default: return model::NONE;
+    }
+  }
+
+  void ModelFile::open(const path_type& path, const mode_type mode)
+  {
+    close();
+
+    mode_ = mode;
+
+    if (mode_ == WRITE) {
+      os_.open(path.string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (! os_)
+	throw std::runtime_error("unable to open: " + path.string());
+    } else {
+      if (! boost::filesystem::is_regular_file(path))
+	throw std::runtime_error("no model file? " + path.string());
+
+      is_.open(path.string().c_str(), std::ios::in | std::ios::binary);
+      if (! is_)
+	throw std::runtime_error("unable to open: " + path.string());
+    }
+  }
+
+  void ModelFile::close()
+  {
+    if (os_.is_open()) {
+      os_.close();
+      if (! os_)
+	throw std::runtime_error("model file write failed");
+    }
+
+    if (is_.is_open())
+      is_.close();
+    is_.clear();
+
+    offset_ = 0;
+  }
+
+  void ModelFile::write_header(const model_type& model, const size_type hidden, const size_type embedding)
+  {
+    __write(model_file_magic, sizeof(model_file_magic));
+
+    write(uint64_t(version));
+    write(uint64_t(model));
+    write(uint64_t(hidden));
+    write(uint64_t(embedding));
+  }
+
+  void ModelFile::read_header(model_type& model, size_type& hidden, size_type& embedding)
+  {
+    char magic[sizeof(model_file_magic)];
+    __read(magic, sizeof(magic));
+
+    if (std::memcmp(magic, model_file_magic, sizeof(magic)) != 0)
+      throw std::runtime_error("this is not a binary model file");
+
+    uint64_t value = 0;
+
+    read(value);
+    if (value != version)
+      throw std::runtime_error("unsupported binary model version");
+
+    read(value);
+    model = model_type(value);
+
+    read(value);
+    hidden = value;
+
+    read(value);
+    embedding = value;
+  }
+
+  void ModelFile::write(const void* data, const size_type size)
+  {
+    align();
+    __write(data, size);
+  }
+
+  void ModelFile::read(void* data, const size_type size)
+  {
+    align();
+    __read(data, size);
+  }
+
+  void ModelFile::write(const utils::piece& symbol)
+  {
+    write(uint64_t(symbol.size()));
+    __write(symbol.data(), symbol.size());
+  }
+
+  utils::piece ModelFile::read_symbol()
+  {
+    uint64_t size = 0;
+    read(size);
+
+    symbol_.resize(size);
+    if (size)
+      __read(&(*symbol_.begin()), size);
+
+    return utils::piece(symbol_);
+  }
+
+  void ModelFile::align()
+  {
+    static const char padding[alignment] = {0};
+
+    char skip[alignment];
+
+    if (mode_ == WRITE)
+      __write(padding, (alignment - offset_ % alignment) % alignment);
+    else
+      __read(skip, (alignment - offset_ % alignment) % alignment);
+  }
+
+  void ModelFile::__write(const void* data, const size_type size)
+  {
+    if (mode_ != WRITE)
+      throw std::runtime_error("model file is not opened for writing");
+
+    os_.write((const char*) data, size);
+    offset_ += size;
+  }
+
+  void ModelFile::__read(void* data, const size_type size)
+  {
+    if (mode_ != READ)
+      throw std::runtime_error("model file is not opened for reading");
+    if (! size) return;
+
+    if (! is_.read((char*) data, size))
+      throw std::runtime_error("truncated binary model file");
+    offset_ += size;
+  }
+};
@@ -0,0 +1,101 @@
+// -*- mode: c++ -*-
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#ifndef __TRANCE__MODEL_FILE__HPP__
+#define __TRANCE__MODEL_FILE__HPP__ 1
+
+//
+// single file binary model
+//
+// The file starts with a versioned header followed by the parameters in the order of the stream
+// operators of each model. Each parameter is a symbol table, if any, followed by its raw values,
+// which start at an aligned offset, and are read directly into the tensors of the model.
+//
+// header: magic (8 bytes), version, model, hidden, embedding (uint64 each)
+// symbol: size (uint64), characters
+//
+
+#include <stdint.h>
+
+#include <string>
+#include <fstream>
+
+#include <trance/model/model_type.hpp>
+
+#include <utils/piece.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+namespace trance
+{
+  class ModelFile
+  {
+  public:
+    typedef size_t    size_type;
+    typedef ptrdiff_t difference_type;
+    typedef float     parameter_type;
+
+    typedef boost::filesystem::path path_type;
+
+    typedef model::ModelType model_type;
+
+    typedef enum {
+      READ,
+      WRITE,
+    } mode_type;
+
+    static const uint64_t version   = 1;
+    static const size_type alignment = 64;
+
+  public:
+    ModelFile() : mode_(READ), offset_(0) {}
+    ModelFile(const path_type& path, const mode_type mode) : mode_(READ), offset_(0)
+    {
+      open(path, mode);
+    }
+
+    // true if path is a single file binary model
+    static bool exists(const path_type& path);
+
+    // model type from the header, or NONE
+    static model_type model(const path_type& path);
+
+  public:
+    void open(const path_type& path, const mode_type mode);
+    void close();
+
+    void write_header(const model_type& model, const size_type hidden, const size_type embedding);
+    void read_header(model_type& model, size_type& hidden, size_type& embedding);
+
+    // raw values from an aligned offset
+    void write(const void* data, const size_type size);
+    void read(void* data, const size_type size);
+
+    // the symbol is valid until the next read
+    void write(const utils::piece& symbol);
+    utils::piece read_symbol();
+
+    void write(const uint64_t& value) { __write(&value, sizeof(value)); }
+    void read(uint64_t& value) { __read(&value, sizeof(value)); }
+
+    // pad to the alignment
+    void align();
+
+  private:
+    void __write(const void* data, const size_type size);
+    void __read(void* data, const size_type size);
+
+  private:
+    mode_type mode_;
+
+    std::ofstream os_;
+    std::ifstream is_;
+    size_type     offset_;
+
+    std::string symbol_;
+  };
+};
+
+#endif
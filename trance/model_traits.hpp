@@ -34,7 +34,7 @@ namespace trance
   {
     typedef model::Model1    model_type;
     typedef gradient::Model1 gradient_type;
-    typedef parser::Model1   parser_type;
+    typedef parser::Model1<> parser_type;
   };
     
   template <>
@@ -42,7 +42,7 @@ namespace trance
   {
     typedef model::Model2    model_type;
     typedef gradient::Model2 gradient_type;
-    typedef parser::Model2   parser_type;
+    typedef parser::Model2<> parser_type;
   };
     
   template <>
@@ -50,7 +50,7 @@ namespace trance
   {
     typedef model::Model3    model_type;
     typedef gradient::Model3 gradient_type;
-    typedef parser::Model3   parser_type;
+    typedef parser::Model3<> parser_type;
   };
 
   template <>
@@ -58,7 +58,7 @@ namespace trance
   {
     typedef model::Model4    model_type;
     typedef gradient::Model4 gradient_type;
-    typedef parser::Model4   parser_type;
+    typedef parser::Model4<> parser_type;
   };
 
   template <>
@@ -66,7 +66,7 @@ namespace trance
   {
     typedef model::Model5    model_type;
     typedef gradient::Model5 gradient_type;
-    typedef parser::Model5   parser_type;
+    typedef parser::Model5<> parser_type;
   };
 
   template <>
@@ -74,7 +74,7 @@ namespace trance
   {
     typedef model::Model1    model_type;
     typedef gradient::Model1 gradient_type;
-    typedef parser::Model1   parser_type;
+    typedef parser::Model1<> parser_type;
   };
     
   template <>
@@ -82,7 +82,7 @@ namespace trance
   {
     typedef model::Model2    model_type;
     typedef gradient::Model2 gradient_type;
-    typedef parser::Model2   parser_type;
+    typedef parser::Model2<> parser_type;
   };
     
   template <>
@@ -90,7 +90,7 @@ namespace trance
   {
     typedef model::Model3    model_type;
     typedef gradient::Model3 gradient_type;
-    typedef parser::Model3   parser_type;
+    typedef parser::Model3<> parser_type;
   };
 
   template <>
@@ -98,7 +98,7 @@ namespace trance
   {
     typedef model::Model4    model_type;
     typedef gradient::Model4 gradient_type;
-    typedef parser::Model4   parser_type;
+    typedef parser::Model4<> parser_type;
   };
 
   template <>
@@ -106,47 +106,47 @@ namespace trance
   {
     typedef model::Model5    model_type;
     typedef gradient::Model5 gradient_type;
-    typedef parser::Model5   parser_type;
+    typedef parser::Model5<> parser_type;
   };
   
   template <>
-  struct model_traits<parser::Model1>
+  struct model_traits<parser::Model1<> >
   {
     typedef model::Model1    model_type;
     typedef gradient::Model1 gradient_type;
-    typedef parser::Model1   parser_type;
+    typedef parser::Model1<> parser_type;
   };
     
   template <>
-  struct model_traits<parser::Model2>
+  struct model_traits<parser::Model2<> >
   {
     typedef model::Model2    model_type;
     typedef gradient::Model2 gradient_type;
-    typedef parser::Model2   parser_type;
+    typedef parser::Model2<> parser_type;
   };
     
   template <>
-  struct model_traits<parser::Model3>
+  struct model_traits<parser::Model3<> >
   {
     typedef model::Model3    model_type;
     typedef gradient::Model3 gradient_type;
-    typedef parser::Model3   parser_type;
+    typedef parser::Model3<> parser_type;
   };
 
   template <>
-  struct model_traits<parser::Model4>
+  struct model_traits<parser::Model4<> >
   {
     typedef model::Model4    model_type;
     typedef gradient::Model4 gradient_type;
-    typedef parser::Model4   parser_type;
+    typedef parser::Model4<> parser_type;
   };
 
   template <>
-  struct model_traits<parser::Model5>
+  struct model_traits<parser::Model5<> >
   {
     typedef model::Model5    model_type;
     typedef gradient::Model5 gradient_type;
-    typedef parser::Model5   parser_type;
+    typedef parser::Model5<> parser_type;
   };
 };
 
@@ -73,7 +73,7 @@ namespace trance
 	  //std::cerr << "step: " << step << " loss: " << backward.loss_ << std::endl;
 	  
 	  // feature set
-	  if (option.learn_classification()) {
+	  if (option.learn_classification() && state.feature_vector()) {
 	    const feature_vector_type& feats = *state.feature_vector();
 	    
 	    feature_vector_type::const_iterator fiter_end = feats.end();
@@ -220,7 +220,7 @@ namespace trance
 	  //std::cerr << "step: " << step << " loss: " << backward.loss_ << std::endl;
 	  
 	  // feature set
-	  if (option.learn_classification()) {
+	  if (option.learn_classification() && state.feature_vector()) {
 	    const feature_vector_type& feats = *state.feature_vector();
 	    
 	    feature_vector_type::const_iterator fiter_end = feats.end();
@@ -382,7 +382,7 @@ namespace trance
 	  //std::cerr << "step: " << step << " loss: " << backward.loss_ << std::endl;
 
 	  // feature set
-	  if (option.learn_classification()) {
+	  if (option.learn_classification() && state.feature_vector()) {
 	    const feature_vector_type& feats = *state.feature_vector();
 	    
 	    feature_vector_type::const_iterator fiter_end = feats.end();
@@ -595,7 +595,7 @@ namespace trance
 	  //std::cerr << "step: " << step << " loss: " << backward.loss_ << std::endl;
 
 	  // feature set
-	  if (option.learn_classification()) {
+	  if (option.learn_classification() && state.feature_vector()) {
 	    const feature_vector_type& feats = *state.feature_vector();
 	    
 	    feature_vector_type::const_iterator fiter_end = feats.end();
@@ -777,7 +777,7 @@ namespace trance
 	  //std::cerr << "step: " << step << " loss: " << backward.loss_ << std::endl;
 
 	  // feature set
-	  if (option.learn_classification()) {
+	  if (option.learn_classification() && state.feature_vector()) {
 	    const feature_vector_type& feats = *state.feature_vector();
 	    
 	    feature_vector_type::const_iterator fiter_end = feats.end();
@@ -0,0 +1,28 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#include <stdexcept>
+
+#include "packed.hpp"
+
+namespace trance
+{
+  void Packed::assign(const tensor_type& matrix, const size_type rows)
+  {
+    clear();
+
+    if (! rows || matrix.rows() % rows != 0)
+      throw std::runtime_error("rows does not match");
+
+    const size_type blocks = matrix.rows() / rows;
+
+    rows_ = rows;
+    cols_ = matrix.cols();
+
+    panels_.resize(rows_, cols_ * blocks);
+
+    for (size_type i = 0; i != blocks; ++ i)
+      panels_.block(0, cols_ * i, rows_, cols_) = matrix.block(rows_ * i, 0, rows_, cols_);
+  }
+};
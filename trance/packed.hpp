@@ -0,0 +1,83 @@
+// -*- mode: c++ -*-
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#ifndef __TRANCE__PACKED__HPP__
+#define __TRANCE__PACKED__HPP__ 1
+
+//
+// weights packed by the category blocks for inference
+//
+// A matrix of the category blocks stacked by rows, i.e., hidden_ * |categories| rows, is stored as
+// panels placed side by side, each of which is the block of a category. The columns of a block are
+// contiguous with the stride of the block rows, not of the whole rows.
+//
+
+#include <Eigen/Core>
+
+namespace trance
+{
+  class Packed
+  {
+  public:
+    typedef size_t    size_type;
+    typedef ptrdiff_t difference_type;
+    typedef float     parameter_type;
+
+    typedef Eigen::Matrix<parameter_type, Eigen::Dynamic, Eigen::Dynamic> tensor_type;
+    typedef Eigen::Block<const tensor_type>                               block_type;
+
+  public:
+    Packed() : rows_(0), cols_(0) {}
+
+  public:
+    // pack the matrix by the blocks of rows
+    void assign(const tensor_type& matrix, const size_type rows);
+
+    // the row and the column in the packed matrix for matrix(row, col)
+    size_type row(const size_type row) const { return row % rows_; }
+    size_type col(const size_type row, const size_type col) const { return (row / rows_) * cols_ + col; }
+
+    // equivalent to matrix.block(row, col, rows, cols), where the rows do not cross a category block
+    block_type block(const size_type row, const size_type col, const size_type rows, const size_type cols) const
+    {
+      return panels_.block(this->row(row), this->col(row, col), rows, cols);
+    }
+
+  public:
+    bool empty() const { return rows_ == 0; }
+
+    size_type size_bytes() const { return panels_.size() * sizeof(parameter_type); }
+
+    void clear()
+    {
+      rows_ = 0;
+      cols_ = 0;
+      panels_.resize(0, 0);
+    }
+
+    void swap(Packed& x)
+    {
+      std::swap(rows_, x.rows_);
+      std::swap(cols_, x.cols_);
+      panels_.swap(x.panels_);
+    }
+
+  public:
+    size_type   rows_;
+    size_type   cols_;
+    tensor_type panels_;
+  };
+};
+
+namespace std
+{
+  inline
+  void swap(trance::Packed& x, trance::Packed& y)
+  {
+    x.swap(y);
+  }
+};
+
+#endif
@@ -9,13 +9,24 @@
 #include <stdexcept>
 #include <vector>
 #include <queue>
+#include <algorithm>
+#include <limits>
 
 #include <trance/parser/parser.hpp>
 
 #include <trance/state.hpp>
 #include <trance/allocator.hpp>
+#include <trance/lattice.hpp>
 #include <trance/model_traits.hpp>
 
+#include <utils/unordered_map.hpp>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+
 namespace trance
 {
   class Parser : public parser::Parser
@@ -45,6 +56,8 @@ namespace trance
 
       void deallocate(const feature_vector_type* vec)
       {
+	if (! vec) return;
+	
 	cache_.push_back(const_cast<feature_vector_type*>(vec));
       }
       
@@ -54,6 +67,16 @@ namespace trance
 	cache_.clear();
       }
       
+      // release all the feature vectors, but keep them, and their buckets, for the subsequent allocations
+      void reset()
+      {
+	cache_.clear();
+	
+	feature_vector_set_type::iterator fiter_end = feature_vectors_.end();
+	for (feature_vector_set_type::iterator fiter = feature_vectors_.begin(); fiter != fiter_end; ++ fiter)
+	  cache_.push_back(&(*fiter));
+      }
+      
       feature_vector_set_type feature_vectors_;
       cache_type cache_;
     };
@@ -74,9 +97,198 @@ namespace trance
     
     typedef std::vector<state_type, std::allocator<state_type> > derivation_set_type;
     
+    // recombination
+    typedef utils::unordered_map<size_t, size_type,
+				 boost::hash<size_t>, std::equal_to<size_t>,
+				 std::allocator<std::pair<const size_t, size_type> > >::type signature_map_type;
+    typedef utils::unordered_map<state_type, heap_type,
+				 boost::hash<state_type>, std::equal_to<state_type>,
+				 std::allocator<std::pair<const state_type, heap_type> > >::type recombined_type;
+    typedef std::vector<std::pair<state_type, state_type>, std::allocator<std::pair<state_type, state_type> > > spliced_type;
+    
+    typedef Lattice lattice_type;
+    
+    // a team of threads to expand the states of a step: the states are split into contiguous slices, and each slice is
+    // expanded by a worker, a parser with its own allocators and feature states. The successors are merged in the
+    // order of the workers, thus the result is the same as the serial expansion.
+    struct team_type
+    {
+      typedef boost::shared_ptr<Parser> parser_ptr_type;
+      typedef std::vector<parser_ptr_type, std::allocator<parser_ptr_type> > parser_set_type;
+      typedef std::vector<feature_set_type, std::allocator<feature_set_type> > feature_set_set_type;
+      
+      typedef boost::function<void (size_type)> job_type;
+      
+      team_type(const size_type size, const size_type beam_size, const size_type unary_size)
+	: workers_(size), feats_(size), barrier_(size)
+      {
+	for (size_type id = 1; id != size; ++ id) {
+	  workers_[id].reset(new Parser(beam_size, unary_size));
+	  threads_.add_thread(new boost::thread(boost::bind(&team_type::operator(), this, id)));
+	}
+      }
+      
+      ~team_type()
+      {
+	job_ = job_type();
+	barrier_.wait();
+	threads_.join_all();
+      }
+      
+      void operator()(const size_type id)
+      {
+	for (;;) {
+	  barrier_.wait();
+	  
+	  if (job_.empty()) break;
+	  
+	  job_(id);
+	  
+	  barrier_.wait();
+	}
+      }
+      
+      // run the job by the workers together with the calling thread as the worker 0
+      void run(const job_type& job)
+      {
+	job_ = job;
+	barrier_.wait();
+	
+	job_(0);
+	
+	barrier_.wait();
+      }
+      
+      size_type size() const { return workers_.size(); }
+      
+      parser_set_type      workers_;
+      feature_set_set_type feats_;
+      
+      job_type            job_;
+      boost::barrier      barrier_;
+      boost::thread_group threads_;
+    };
+    
+    typedef boost::shared_ptr<team_type> team_ptr_type;
+    
+    template <typename Impl, typename Theta>
+    struct team_job
+    {
+      team_job(Parser& parser,
+	       Impl& impl,
+	       const sentence_type& input,
+	       const grammar_type& grammar,
+	       const feature_set_type& feats,
+	       const Theta& theta,
+	       const heap_type& heap,
+	       const size_type unary_max)
+	: parser_(parser), impl_(impl), input_(input), grammar_(grammar), feats_(feats), theta_(theta), heap_(heap), unary_max_(unary_max) {}
+      
+      void operator()(const size_type id) const
+      {
+	Parser& parser = (id == 0 ? parser_ : *parser_.team_->workers_[id]);
+	const feature_set_type& feats = (id == 0 ? feats_ : parser_.team_->feats_[id]);
+	
+	const size_type size  = parser_.team_->size();
+	const size_type first = heap_.size() * id / size;
+	const size_type last  = heap_.size() * (id + 1) / size;
+	
+	for (size_type i = first; i != last; ++ i)
+	  parser.expand_state(impl_, input_, grammar_, parser_.lattice_, feats, theta_, heap_[i], unary_max_);
+      }
+      
+      Parser&                 parser_;
+      Impl&                   impl_;
+      const sentence_type&    input_;
+      const grammar_type&     grammar_;
+      const feature_set_type& feats_;
+      const Theta&            theta_;
+      const heap_type&        heap_;
+      const size_type         unary_max_;
+    };
+
+    // successor states grouped by their categories for the batched expansion
+    struct batch_type
+    {
+      typedef std::vector<heap_type, std::allocator<heap_type> > state_map_type;
+      typedef std::vector<size_type, std::allocator<size_type> > category_set_type;
+      
+      void push_back(const state_type& state)
+      {
+	const size_type id = state.label().non_terminal_id();
+	
+	if (id >= states_.size())
+	  states_.resize(id + 1);
+	
+	if (states_[id].empty())
+	  categories_.push_back(id);
+	
+	states_[id].push_back(state);
+      }
+      
+      bool empty() const { return categories_.empty(); }
+      
+      void clear()
+      {
+	category_set_type::const_iterator citer_end = categories_.end();
+	for (category_set_type::const_iterator citer = categories_.begin(); citer != citer_end; ++ citer)
+	  states_[*citer].clear();
+	
+	categories_.clear();
+      }
+      
+      state_map_type    states_;
+      category_set_type categories_;
+    };
+    
+    // successors which are scored, but not materialized, by the lazy expansion
+    struct candidate_type
+    {
+      candidate_type(const state_type& state,
+		     const operation_type& operation,
+		     const symbol_type& label,
+		     const word_type& head,
+		     const size_type& index,
+		     const double& score)
+	: state_(state), operation_(operation), label_(label), head_(head), index_(index), score_(score) {}
+      
+      state_type     state_;
+      operation_type operation_;
+      symbol_type    label_;
+      word_type      head_;
+      size_type      index_;
+      double         score_;
+    };
+    
+    typedef std::vector<candidate_type, std::allocator<candidate_type> > candidate_set_type;
+    
+    typedef batch_type::category_set_type category_set_type;
+    typedef std::vector<size_type, std::allocator<size_type> > column_set_type;
+    typedef std::vector<column_set_type, std::allocator<column_set_type> > column_map_type;
+    
+    struct candidate_compare
+    {
+      // compare by greater so that better scored candidates come first
+      bool operator()(const candidate_type& x, const candidate_type& y) const
+      {
+	return x.score_ > y.score_;
+      }
+    };
+    
+    struct candidate_index_compare
+    {
+      bool operator()(const candidate_type& x, const candidate_type& y) const
+      {
+	return x.index_ < y.index_;
+      }
+    };
+    
   public:
     Parser(size_type beam_size, size_type unary_size, bool terminate_early=false)
-      : beam_size_(beam_size), unary_size_(unary_size), terminate_early_(terminate_early) {}
+      : beam_size_(beam_size), unary_size_(unary_size), terminate_early_(terminate_early),
+	beam_margin_(0.0), beam_min_(1), beam_max_(beam_size),
+	bound_upper_(0.0), bound_idle_lower_(0.0), bound_idle_upper_(0.0),
+	batch_(false), lazy_(false), recombine_(false), materialize_(true), threads_(1), expanded_(0) {}
     
   public:
     
@@ -122,72 +334,97 @@ namespace trance
 	       const size_type kbest,
 	       derivation_set_type& derivations,
 	       const BestAction& best_action)
+    {
+      typedef typename model_traits<Theta>::parser_type impl_type;
+      
+      // the operations are specialized by the size of the hidden layer known when the model is loaded, so that
+      // the layers are computed by the fixed size kernels without the temporaries allocated on the heap
+      switch (theta.hidden_) {
+      case 32:
+	search(typename impl_type::template rebind<32>::type(), input, grammar, signature, feats, theta, kbest, derivations, best_action);
+	break;
+      case 64:
+	search(typename impl_type::template rebind<64>::type(), input, grammar, signature, feats, theta, kbest, derivations, best_action);
+	break;
+      case 128:
+	search(typename impl_type::template rebind<128>::type(), input, grammar, signature, feats, theta, kbest, derivations, best_action);
+	break;
+      default:
+	search(impl_type(), input, grammar, signature, feats, theta, kbest, derivations, best_action);
+      }
+    }
+    
+    template <typename Impl, typename Theta, typename BestAction>
+    void search(Impl impl,
+		const sentence_type& input,
+		const grammar_type& grammar,
+		const signature_type& signature,
+		const feature_set_type& feats,
+		const Theta& theta,
+		const size_type kbest,
+		derivation_set_type& derivations,
+		const BestAction& best_action)
     {
       derivations.clear();
       
       if (input.empty()) return;
       
       initialize(input, feats, theta);
-
-      typename model_traits<Theta>::parser_type impl;
+      
+      lattice_.assign(input, grammar, signature, theta);
+      
+      precompute(theta);
       
       impl.operation_axiom(*this, input, feats, theta);
       
+      if (threads_ > 1 && ! batch_ && ! lazy_)
+	prepare(input, feats, theta);
+      
       const size_type unary_max = input.size() * unary_size_;
       const size_type step_last = input.size() * 2 + unary_max;
       
+      // the scores by the feature functions are not bounded, thus the early termination is performed only without them
+      const bool early = terminate_early_ && kbest == 1 && feats.empty();
+      
+      if (early)
+	bound(theta);
+      
       // search
       for (size_type step = 0; step != step_last; ++ step) {
 	heap_type& heap = agenda_[step];
 	
 	if (heap.empty()) break;
 	
-	prune(heap, feats, beam_size_);
+	if (recombine_)
+	  recombine(heap, feats);
+	
+	prune(heap, feats, beam(heap));
+	
+	expanded_ += heap.size();
 	
 	// best_action
 	best_action(step, heap.back());
 
-	heap_type::const_iterator hiter_end = heap.end();
-	for (heap_type::const_iterator hiter = heap.begin(); hiter != hiter_end; ++ hiter) {
-	  const state_type& state = *hiter;
-	  
-	  if (state.operation().finished())
-	    impl.operation_idle(*this, feats, theta, state);
-	  else {
-	    // we perform shift..
-	    if (state.next() < input.size()) {
-	      const grammar_type::rule_set_type& rules = grammar.preterminal(signature, input[state.next()]);
-	      
-	      grammar_type::rule_set_type::const_iterator riter_end = rules.end();
-	      for (grammar_type::rule_set_type::const_iterator riter = rules.begin(); riter != riter_end; ++ riter)
-		impl.operation_shift(*this, feats, theta, state, input[state.next()], riter->lhs_);
-	    }
-	    
-	    // we perform unary
-	    if (state.stack() && state.unary() < unary_max && state.operation().closure() < unary_size_) {
-	      const grammar_type::rule_set_type& rules = grammar.unary(state.label());
-	      
-	      grammar_type::rule_set_type::const_iterator riter_end = rules.end();
-	      for (grammar_type::rule_set_type::const_iterator riter = rules.begin(); riter != riter_end; ++ riter)
-		impl.operation_unary(*this, feats, theta, state, riter->lhs_);
-	    }
-	    
-	    // final...
-	    if (state.stack()
-		&& state.stack().label() == symbol_type::AXIOM
-		&& state.label() == grammar.goal_
-		&& state.next() == input.size())
-	      impl.operation_final(*this, feats, theta, state);
-	    
-	    // we will perform reduce
-	    if (state.stack() && state.stack().label() != symbol_type::AXIOM) {
-	      const grammar_type::rule_set_type& rules = grammar.binary(state.stack().label(), state.label());
-	      
-	      grammar_type::rule_set_type::const_iterator riter_end = rules.end();
-	      for (grammar_type::rule_set_type::const_iterator riter = rules.begin(); riter != riter_end; ++ riter)
-		impl.operation_reduce(*this, feats, theta, state, riter->lhs_);
-	    }
-	  }
+	// early termination: the best state is finished, and dominates the rest until the last step
+	if (early && dominate(heap, step_last - step)) {
+	  terminate(impl, feats, theta, heap.back(), step, step_last, best_action);
+	  break;
+	}
+
+	if (threads_ > 1 && ! batch_ && ! lazy_)
+	  expand_parallel(impl, input, grammar, feats, theta, heap, step, unary_max);
+	else {
+	  heap_type::const_iterator hiter_end = heap.end();
+	  for (heap_type::const_iterator hiter = heap.begin(); hiter != hiter_end; ++ hiter)
+	    expand_state(impl, input, grammar, lattice_, feats, theta, *hiter, unary_max);
+	}
+	
+	if (lazy_)
+	  materialize(impl, feats, theta, step + 1 == step_last ? std::max(beam_limit(), kbest) : beam_limit());
+	else if (batch_) {
+	  expand(impl, theta, operation_type::SHIFT,  batch_shift_);
+	  expand(impl, theta, operation_type::REDUCE, batch_reduce_);
+	  expand(impl, theta, operation_type::UNARY,  batch_unary_);
 	}
       }
       
@@ -202,12 +439,17 @@ namespace trance
 	  if (heap.empty()) break;
 	  
 	  if (step > step_drop) {
-	    prune(heap, feats, beam_size_);
+	    if (recombine_)
+	      recombine(heap, feats);
+	    
+	    prune(heap, feats, beam(heap));
 	    
 	    // best_action
 	    best_action(step, heap.back());
 	  }
 	  
+	  expanded_ += heap.size();
+	  
 	  heap_type::const_iterator hiter_end = heap.end();
 	  for (heap_type::const_iterator hiter = heap.begin(); hiter != hiter_end; ++ hiter) {
 	    const state_type& state = *hiter;
@@ -217,7 +459,7 @@ namespace trance
 	    else {
 	      // we perform shift.... this should not happen, though..
 	      if (state.next() < input.size()) {
-		const grammar_type::rule_set_type& rules = grammar.preterminal(signature, input[state.next()]);
+		const grammar_type::rule_set_type& rules = *lattice_.preterminals_[state.next()];
 		
 		grammar_type::rule_set_type::const_iterator riter_end = rules.end();
 		for (grammar_type::rule_set_type::const_iterator riter = rules.begin(); riter != riter_end; ++ riter)
@@ -254,41 +496,582 @@ namespace trance
       heap_type& heap = agenda_[step_last];
       
       if (! heap.empty()) {
+	if (recombine_)
+	  recombine(heap, feats);
+	
 	prune(heap, feats, kbest);
 	
+	if (recombine_ && kbest > 1)
+	  splice(heap, kbest);
+	
 	best_action(step_last, heap.back());
 	
 	derivations.insert(derivations.end(), heap.rbegin(), heap.rend());
       }
     }
     
+    // expand a state by the operations allowed by the grammar
+    template <typename Impl, typename Theta>
+    void expand_state(Impl& impl,
+		      const sentence_type& input,
+		      const grammar_type& grammar,
+		      const lattice_type& lattice,
+		      const feature_set_type& feats,
+		      const Theta& theta,
+		      const state_type& state,
+		      const size_type unary_max)
+    {
+      if (state.operation().finished())
+	impl.operation_idle(*this, feats, theta, state);
+      else {
+	// we perform shift..
+	if (state.next() < input.size()) {
+	  const grammar_type::rule_set_type& rules = *lattice.preterminals_[state.next()];
+	  
+	  grammar_type::rule_set_type::const_iterator riter_end = rules.end();
+	  for (grammar_type::rule_set_type::const_iterator riter = rules.begin(); riter != riter_end; ++ riter)
+	    if (lazy_)
+	      candidate(operation_type::SHIFT, state, riter->lhs_, input[state.next()],
+			score_shift(feats, theta, input[state.next()], riter->lhs_, features_));
+	    else if (batch_)
+	      batch_shift_.push_back(impl.state_shift(*this, feats, theta, state, input[state.next()], riter->lhs_));
+	    else
+	      impl.operation_shift(*this, feats, theta, state, input[state.next()], riter->lhs_);
+	}
+	
+	// we perform unary
+	if (state.stack() && state.unary() < unary_max && state.operation().closure() < unary_size_) {
+	  const grammar_type::rule_range_type rules = grammar.unary(state.label());
+	  
+	  grammar_type::rule_range_type::const_iterator riter_end = rules.end();
+	  for (grammar_type::rule_range_type::const_iterator riter = rules.begin(); riter != riter_end; ++ riter)
+	    if (lazy_)
+	      candidate(operation_type(operation_type::UNARY, state.operation().closure() + 1), state, riter->lhs_, symbol_type::EPSILON,
+			score_unary(feats, theta, state, riter->lhs_, features_));
+	    else if (batch_)
+	      batch_unary_.push_back(impl.state_unary(*this, feats, theta, state, riter->lhs_));
+	    else
+	      impl.operation_unary(*this, feats, theta, state, riter->lhs_);
+	}
+	
+	// final...
+	if (state.stack()
+	    && state.stack().label() == symbol_type::AXIOM
+	    && state.label() == grammar.goal_
+	    && state.next() == input.size())
+	  impl.operation_final(*this, feats, theta, state);
+	
+	// we will perform reduce
+	if (state.stack() && state.stack().label() != symbol_type::AXIOM) {
+	  const grammar_type::rule_range_type rules = grammar.binary(state.stack().label(), state.label());
+	  
+	  grammar_type::rule_range_type::const_iterator riter_end = rules.end();
+	  for (grammar_type::rule_range_type::const_iterator riter = rules.begin(); riter != riter_end; ++ riter)
+	    if (lazy_)
+	      candidate(operation_type::REDUCE, state, riter->lhs_, symbol_type::EPSILON,
+			score_reduce(feats, theta, state, riter->lhs_, features_));
+	    else if (batch_)
+	      batch_reduce_.push_back(impl.state_reduce(*this, feats, theta, state, riter->lhs_));
+	    else
+	      impl.operation_reduce(*this, feats, theta, state, riter->lhs_);
+	}
+      }
+    }
+    
+    // expand the states of the heap by the team of threads
+    template <typename Impl, typename Theta>
+    void expand_parallel(Impl& impl,
+			 const sentence_type& input,
+			 const grammar_type& grammar,
+			 const feature_set_type& feats,
+			 const Theta& theta,
+			 const heap_type& heap,
+			 const size_type step,
+			 const size_type unary_max)
+    {
+      team_->run(team_job<Impl, Theta>(*this, impl, input, grammar, feats, theta, heap, unary_max));
+      
+      heap_type& successors = agenda_[step + 1];
+      
+      for (size_type id = 1; id != team_->size(); ++ id) {
+	heap_type& expanded = team_->workers_[id]->agenda_[step + 1];
+	
+	successors.insert(successors.end(), expanded.begin(), expanded.end());
+	expanded.clear();
+      }
+    }
+    
+    // prepare the team of threads for the sentence
+    void prepare(const sentence_type& input, const feature_set_type& feats, const model_type& theta)
+    {
+      if (! team_ || team_->size() != threads_)
+	team_.reset(new team_type(threads_, beam_size_, unary_size_));
+      
+      for (size_type id = 1; id != team_->size(); ++ id) {
+	team_->feats_[id] = feats.clone();
+	
+	team_->workers_[id]->initialize(input, team_->feats_[id], theta);
+	team_->workers_[id]->materialize_ = materialize_;
+	team_->workers_[id]->queue_ = queue_;
+	team_->workers_[id]->precomputed_ = precomputed_;
+      }
+    }
+    
+    // compute the hidden layers and the classification scores of the successors grouped by their categories:
+    // the inputs of all the successors in a group are gathered as columns so that a single matrix-matrix
+    // product replaces a matrix-vector product for each successor.
+    template <typename Impl, typename Theta>
+    void expand(const Impl& impl, const Theta& theta, const operation_type& operation, batch_type& batch)
+    {
+      if (batch.empty()) return;
+      
+      const tensor_type& W = (operation.shift() ? theta.Wsh_ : (operation.reduce() ? theta.Wre_ : theta.Wu_));
+      const quantized_type& Q = (operation.shift() ? theta.Qsh_ : (operation.reduce() ? theta.Qre_ : theta.Qu_));
+      const tensor_type& B = (operation.shift() ? theta.Bsh_ : (operation.reduce() ? theta.Bre_ : theta.Bu_));
+      
+      const size_type index_operation  = theta.index_operation(operation);
+      const size_type offset_operation = index_operation * theta.hidden_;
+      
+      batch_type::category_set_type::const_iterator citer_end = batch.categories_.end();
+      for (batch_type::category_set_type::const_iterator citer = batch.categories_.begin(); citer != citer_end; ++ citer) {
+	const heap_type& states = batch.states_[*citer];
+	
+	const symbol_type label = states.front().label();
+	
+	const size_type offset_classification = theta.offset_classification(label);
+	const size_type offset_category       = theta.offset_category(label);
+	
+	// the float weights may be released once quantized
+	inputs_.resize(Q.empty() ? size_type(W.cols()) : Q.cols_, states.size());
+	
+	for (size_type i = 0; i != states.size(); ++ i) {
+	  const state_type& state = states[i].derivation();
+	  
+	  if (operation.shift())
+	    impl.input_shift(*this, theta, state, states[i].head(), inputs_, i);
+	  else if (operation.reduce())
+	    impl.input_reduce(*this, theta, state, inputs_, i);
+	  else
+	    impl.input_unary(*this, theta, state, inputs_, i);
+	}
+	
+	product(theta, operation, offset_category);
+	
+	for (size_type i = 0; i != states.size(); ++ i) {
+	  state_type state = states[i];
+	  
+	  state.layer(theta.hidden_) = (B.block(offset_category, 0, theta.hidden_, 1)
+					+ layers_.col(i)
+					).array().unaryExpr(model_type::activation());
+	  
+	  const double score = (theta.Wc_.row(offset_classification).segment(offset_operation, theta.hidden_).dot(state.layer(theta.hidden_).col(0))
+				+ theta.Bc_(offset_classification, index_operation));
+	  
+	  state.score() += score;
+	}
+      }
+      
+      batch.clear();
+    }
+    
+    // layers_ = W[category] * inputs_ by the low-rank, the quantized, the packed or the float weights, whichever
+    // available first, as in accumulate of the operations. The quantized weights have no matrix-matrix kernel, thus
+    // the columns are accumulated one by one.
+    template <typename Theta>
+    void product(const Theta& theta, const operation_type& operation, const size_type offset_category)
+    {
+      const tensor_type& W = (operation.shift() ? theta.Wsh_ : (operation.reduce() ? theta.Wre_ : theta.Wu_));
+      const quantized_type& Q = (operation.shift() ? theta.Qsh_ : (operation.reduce() ? theta.Qre_ : theta.Qu_));
+      const packed_type& P = (operation.shift() ? theta.Psh_ : (operation.reduce() ? theta.Pre_ : theta.Pu_));
+      const low_rank_type& L = (operation.shift() ? theta.Lsh_ : (operation.reduce() ? theta.Lre_ : theta.Lu_));
+      
+      layers_.resize(theta.hidden_, inputs_.cols());
+      
+      if (! L.empty())
+	layers_.noalias() = L.left(offset_category) * (L.right(offset_category).transpose() * inputs_);
+      else if (! Q.empty()) {
+	layers_.setZero();
+	
+	for (difference_type i = 0; i != inputs_.cols(); ++ i)
+	  Q.accumulate(offset_category, 0, theta.hidden_, inputs_.rows(), inputs_.col(i).data(), layers_.col(i).data());
+      } else if (! P.empty())
+	layers_.noalias() = P.block(offset_category, 0, theta.hidden_, inputs_.rows()) * inputs_;
+      else
+	layers_.noalias() = W.block(offset_category, 0, theta.hidden_, inputs_.rows()) * inputs_;
+    }
+    
+    void candidate(const operation_type& operation,
+		   const state_type& state,
+		   const symbol_type& label,
+		   const word_type& head,
+		   const double& score)
+    {
+      candidates_.push_back(candidate_type(state, operation, label, head, candidates_.size(), score + state.score()));
+    }
+    
+    // add the classification scores to the candidates of an operation grouped by their categories
+    template <typename Impl, typename Theta>
+    void score(const Impl& impl, const Theta& theta, const operation_type& operation)
+    {
+      const tensor_type& W = (operation.shift() ? theta.Wsh_ : (operation.reduce() ? theta.Wre_ : theta.Wu_));
+      const quantized_type& Q = (operation.shift() ? theta.Qsh_ : (operation.reduce() ? theta.Qre_ : theta.Qu_));
+      const tensor_type& B = (operation.shift() ? theta.Bsh_ : (operation.reduce() ? theta.Bre_ : theta.Bu_));
+      
+      const size_type index_operation  = theta.index_operation(operation);
+      const size_type offset_operation = index_operation * theta.hidden_;
+      
+      for (size_type i = 0; i != candidates_.size(); ++ i)
+	if (candidates_[i].operation_.operation() == operation.operation()) {
+	  const size_type id = candidates_[i].label_.non_terminal_id();
+	  
+	  if (id >= grouped_.size())
+	    grouped_.resize(id + 1);
+	  
+	  if (grouped_[id].empty())
+	    categories_.push_back(id);
+	  
+	  grouped_[id].push_back(i);
+	}
+      
+      category_set_type::const_iterator citer_end = categories_.end();
+      for (category_set_type::const_iterator citer = categories_.begin(); citer != citer_end; ++ citer) {
+	const column_set_type& grouped = grouped_[*citer];
+	
+	const symbol_type label = candidates_[grouped.front()].label_;
+	
+	const size_type offset_classification = theta.offset_classification(label);
+	const size_type offset_category       = theta.offset_category(label);
+	
+	inputs_.resize(Q.empty() ? size_type(W.cols()) : Q.cols_, grouped.size());
+	
+	for (size_type i = 0; i != grouped.size(); ++ i) {
+	  const candidate_type& cand = candidates_[grouped[i]];
+	  
+	  if (operation.shift())
+	    impl.input_shift(*this, theta, cand.state_, cand.head_, inputs_, i);
+	  else if (operation.reduce())
+	    impl.input_reduce(*this, theta, cand.state_, inputs_, i);
+	  else
+	    impl.input_unary(*this, theta, cand.state_, inputs_, i);
+	}
+	
+	product(theta, operation, offset_category);
+	
+	for (size_type i = 0; i != grouped.size(); ++ i) {
+	  candidate_layers_.col(grouped[i]) = (B.block(offset_category, 0, theta.hidden_, 1)
+					       + layers_.col(i)
+					       ).array().unaryExpr(model_type::activation());
+	  
+	  candidates_[grouped[i]].score_ += (theta.Wc_.row(offset_classification).segment(offset_operation, theta.hidden_).dot(candidate_layers_.col(grouped[i]))
+					     + theta.Bc_(offset_classification, index_operation));
+	}
+	
+	grouped_[*citer].clear();
+      }
+      
+      categories_.clear();
+    }
+    
+    // score all the candidates, and materialize only those which may survive the pruning by the beam.
+    // The hidden layers computed by the scoring are kept by the candidates, and copied to the materialized states.
+    template <typename Impl, typename Theta>
+    void materialize(Impl& impl, const feature_set_type& feats, const Theta& theta, const size_type beam)
+    {
+      if (candidates_.empty()) return;
+      
+      candidate_layers_.resize(theta.hidden_, candidates_.size());
+      
+      score(impl, theta, operation_type::SHIFT);
+      score(impl, theta, operation_type::REDUCE);
+      score(impl, theta, operation_type::UNARY);
+      
+      if (candidates_.size() > beam) {
+	std::nth_element(candidates_.begin(), candidates_.begin() + beam, candidates_.end(), candidate_compare());
+	candidates_.erase(candidates_.begin() + beam, candidates_.end());
+	
+	// keep the order of the candidates as generated
+	std::sort(candidates_.begin(), candidates_.end(), candidate_index_compare());
+      }
+      
+      candidate_set_type::const_iterator citer_end = candidates_.end();
+      for (candidate_set_type::const_iterator citer = candidates_.begin(); citer != citer_end; ++ citer) {
+	state_type state;
+	
+	if (citer->operation_.shift())
+	  state = impl.state_shift(*this, feats, theta, citer->state_, citer->head_, citer->label_);
+	else if (citer->operation_.reduce())
+	  state = impl.state_reduce(*this, feats, theta, citer->state_, citer->label_);
+	else
+	  state = impl.state_unary(*this, feats, theta, citer->state_, citer->label_);
+	
+	state.layer(theta.hidden_) = candidate_layers_.col(citer->index_);
+	state.score() = citer->score_;
+      }
+      
+      candidates_.clear();
+    }
+    
+    // the precomputed terms of the words in the lattice, looked up by their positions
+    template <typename Theta>
+    void precompute(const Theta& theta)
+    {
+      if (theta.cache_.empty()) {
+	precomputed_.resize(0, 0);
+	return;
+      }
+      
+      precomputed_.resize(theta.cache_.rows(), lattice_.size());
+      
+      for (size_type i = 0; i != lattice_.size(); ++ i)
+	theta.precompute(lattice_.terminals_[i], precomputed_.col(i).data());
+    }
+    
     void initialize(const sentence_type& input, const feature_set_type& feats, const model_type& theta)
     {
       // # of operations is 2n + # of unary rules + final
-      agenda_.clear();
-      agenda_.resize(input.size() * 2 + input.size() * unary_size_ + 1);
+      const size_type agenda_size = input.size() * 2 + input.size() * unary_size_ + 1;
+      
+      // the storage of heaps is kept across sentences: the heaps beyond the agenda size are moved to the spare heaps,
+      // and reused when the agenda grows.
+      agenda_type::iterator aiter_end = agenda_.end();
+      for (agenda_type::iterator aiter = agenda_.begin(); aiter != aiter_end; ++ aiter)
+	aiter->clear();
+      
+      while (agenda_.size() > agenda_size) {
+	heaps_.push_back(heap_type());
+	heaps_.back().swap(agenda_.back());
+	agenda_.pop_back();
+      }
+      
+      while (agenda_.size() < agenda_size) {
+	agenda_.push_back(heap_type());
+	
+	if (! heaps_.empty()) {
+	  agenda_.back().swap(heaps_.back());
+	  heaps_.pop_back();
+	}
+      }
 
       // state allocator
-      state_allocator_.clear();
       state_allocator_.assign(state_type::size(theta.hidden_));
       
       // feature(s)
+      if (materialize_ && feats.folded())
+	throw std::runtime_error("the features are folded, but materialized");
+      if (lazy_ && recombine_)
+	throw std::runtime_error("the lazy expansion does not recombine the candidates");
+      
       const_cast<feature_set_type&>(feats).initialize();
-      feature_vector_allocator_.clear();
+      feature_vector_allocator_.reset();
+      
+      // recombination
+      recombined_.clear();
+      
+      expanded_ = 0;
+    }
+    
+    // beam size for the heap: when adaptive, the # of states within the margin from the best state, which is
+    // bounded by [beam_min_, beam_max_], so that the beam is narrowed when the best state leads by a large
+    // margin, and widened when the scores are flat.
+    size_type beam(const heap_type& heap) const
+    {
+      if (beam_margin_ <= 0.0) return beam_size_;
+      
+      double score_max = - std::numeric_limits<double>::infinity();
+      
+      heap_type::const_iterator hiter_end = heap.end();
+      for (heap_type::const_iterator hiter = heap.begin(); hiter != hiter_end; ++ hiter)
+	score_max = std::max(score_max, hiter->score());
+      
+      const double threshold = score_max - beam_margin_;
+      
+      size_type size = 0;
+      for (heap_type::const_iterator hiter = heap.begin(); hiter != hiter_end; ++ hiter)
+	size += (hiter->score() >= threshold);
+      
+      return std::max(beam_min_, std::min(beam_max_, size));
+    }
+    
+    // the maximum beam size
+    size_type beam_limit() const
+    {
+      return (beam_margin_ <= 0.0 ? beam_size_ : beam_max_);
+    }
+
+    // bounds of the score added by an operation: the layer is clipped to [-1, 1] by the activation, thus
+    // Wc x layer + Bc of a classification row and an operation is within Bc -/+ |Wc|_1
+    template <typename Theta>
+    void bound(const Theta& theta)
+    {
+      const size_type index_operation       = theta.index_operation(operation_type::IDLE);
+      const size_type offset_operation      = index_operation * theta.hidden_;
+      const size_type offset_classification = theta.offset_classification(symbol_type::IDLE);
+      
+      const double norm_idle = theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_).template lpNorm<1>();
+      
+      bound_idle_lower_ = theta.Bc_(offset_classification, index_operation) - norm_idle;
+      bound_idle_upper_ = theta.Bc_(offset_classification, index_operation) + norm_idle;
+      
+      bound_upper_ = bound_idle_upper_;
+      for (difference_type row = 0; row != theta.Wc_.rows(); ++ row)
+	for (difference_type op = 0; op != theta.Bc_.cols(); ++ op)
+	  bound_upper_ = std::max(bound_upper_, double(theta.Bc_(row, op) + theta.Wc_.block(row, op * theta.hidden_, 1, theta.hidden_).template lpNorm<1>()));
+    }
+    
+    // whether the best state of the pruned heap is finished, and dominates the rest during the remaining steps.
+    // The finished state is followed only by idle operations, thus gains at least the lower bound of idle at each
+    // step, while the rest gain at most the upper bound of idle when finished, or of any operation otherwise.
+    // The best state stays the best at every step, and is neither pruned nor recombined by the full search.
+    bool dominate(const heap_type& heap, const size_type remain) const
+    {
+      if (! heap.back().operation().finished()) return false;
+      
+      const double lower = heap.back().score() + remain * bound_idle_lower_;
+      
+      heap_type::const_iterator hiter_end = heap.end() - 1;
+      for (heap_type::const_iterator hiter = heap.begin(); hiter != hiter_end; ++ hiter)
+	if (hiter->score() + remain * (hiter->operation().finished() ? bound_idle_upper_ : bound_upper_) >= lower)
+	  return false;
+      
+      return true;
+    }
+    
+    // carry the finished state forward to the last step by the idle operations, without expanding the rest
+    template <typename Impl, typename Theta, typename BestAction>
+    void terminate(Impl& impl,
+		   const feature_set_type& feats,
+		   const Theta& theta,
+		   state_type state,
+		   const size_type step_first,
+		   const size_type step_last,
+		   const BestAction& best_action)
+    {
+      for (size_type step = step_first; step != step_last; ++ step) {
+	if (step != step_first) {
+	  expanded_ += 1;
+	  best_action(step, state);
+	}
+
+	impl.operation_idle(*this, feats, theta, state);
+
+	state = agenda_[step + 1].back();
+      }
+    }
+
+    // merge the equivalent states in the heap, keeping the better ones. The merged states are not deallocated,
+    // but kept as back-pointers from the survived states for the k-best derivations.
+    void recombine(heap_type& heap, const feature_set_type& feats)
+    {
+      signatures_.clear();
+      
+      size_type pos = 0;
+      while (pos != heap.size()) {
+	std::pair<signature_map_type::iterator, bool> result = signatures_.insert(std::make_pair(heap[pos].signature(feats), pos));
+	
+	if (result.second || ! heap[result.first->second].equivalent(heap[pos], feats)) {
+	  ++ pos;
+	  continue;
+	}
+	
+	state_type& survived = heap[result.first->second];
+	
+	if (heap[pos].score() > survived.score())
+	  std::swap(survived, heap[pos]);
+	
+	heap_type& merged = recombined_[survived];
+	merged.push_back(heap[pos]);
+	
+	recombined_type::iterator riter = recombined_.find(heap[pos]);
+	if (riter != recombined_.end()) {
+	  merged.insert(merged.end(), riter->second.begin(), riter->second.end());
+	  recombined_.erase(riter);
+	}
+	
+	heap[pos] = heap.back();
+	heap.pop_back();
+      }
     }
     
+    // add the k-best derivations from the recombined states: the suffix of a derivation after a recombined state
+    // is spliced onto the histories merged into the state.
+    void splice(heap_type& heap, const size_type kbest)
+    {
+      if (recombined_.empty()) return;
+      
+      const size_type size = heap.size();
+      for (size_type i = 0; i != size; ++ i) {
+	suffix_.clear();
+	
+	for (state_type state = heap[i]; state; state = state.derivation()) {
+	  recombined_type::const_iterator riter = recombined_.find(state);
+	  
+	  if (riter != recombined_.end()) {
+	    heap_type::const_iterator miter_end = riter->second.end();
+	    for (heap_type::const_iterator miter = riter->second.begin(); miter != miter_end; ++ miter)
+	      heap.push_back(splice(state, *miter));
+	  }
+	  
+	  suffix_.push_back(state);
+	}
+      }
+      
+      // the better derivations are preserved at the end, as in prune
+      std::sort(heap.begin(), heap.end(), heap_compare());
+      
+      if (heap.size() > kbest)
+	heap.erase(heap.begin(), heap.end() - kbest);
+    }
+    
+    state_type splice(const state_type& state, const state_type& merged)
+    {
+      if (suffix_.empty()) return merged;
+      
+      const double delta = merged.score() - state.score();
+      
+      spliced_.clear();
+      
+      for (state_type state1 = state, state2 = merged; state1 && state2; state1 = state1.stack(), state2 = state2.stack())
+	spliced_.push_back(std::make_pair(state1, state2));
+      
+      heap_type::const_reverse_iterator siter_end = suffix_.rend();
+      for (heap_type::const_reverse_iterator siter = suffix_.rbegin(); siter != siter_end; ++ siter) {
+	state_type state_new = state_allocator_.clone(*siter);
+	
+	state_new.stack()      = spliced(state_new.stack());
+	state_new.derivation() = spliced(state_new.derivation());
+	state_new.reduced()    = spliced(state_new.reduced());
+	
+	state_new.score() += delta;
+	
+	spliced_.push_back(std::make_pair(*siter, state_new));
+      }
+      
+      return spliced_.back().second;
+    }
+    
+    state_type spliced(const state_type& state) const
+    {
+      spliced_type::const_reverse_iterator siter_end = spliced_.rend();
+      for (spliced_type::const_reverse_iterator siter = spliced_.rbegin(); siter != siter_end; ++ siter)
+	if (siter->first == state)
+	  return siter->second;
+      
+      return state;
+    }
+    
+    // partition the heap so that the best states within the beam are preserved at the end in ascending order
     void prune(heap_type& heap, const feature_set_type& feats, const size_type beam)
     {
       if (heap.empty()) return;
 
       heap_type::iterator hiter_begin = heap.begin();
-      heap_type::iterator hiter       = heap.end();
+      heap_type::iterator hiter       = heap.end() - std::min(beam, heap.size());
       heap_type::iterator hiter_end   = heap.end();
       
-      std::make_heap(hiter_begin, hiter_end, heap_compare());
+      if (hiter != hiter_begin)
+	std::nth_element(hiter_begin, hiter, hiter_end, heap_compare());
       
-      for (/**/; hiter_begin != hiter && std::distance(hiter, hiter_end) != beam; -- hiter)
-	std::pop_heap(hiter_begin, hiter, heap_compare());
+      std::sort(hiter, hiter_end, heap_compare());
       
       // deallocate unused states
       for (heap_type::iterator iter = hiter_begin; iter != hiter; ++ iter) {
@@ -306,15 +1089,69 @@ namespace trance
     size_type unary_size_;
     bool terminate_early_;
     
+    // adaptive beam by the score margin
+    double    beam_margin_;
+    size_type beam_min_;
+    size_type beam_max_;
+    
+    // batched expansion
+    bool batch_;
+    // lazy expansion
+    bool lazy_;
+    // recombination of equivalent states
+    bool recombine_;
+    // sparse feature vectors of the states, required by the output of features and the gradients
+    bool materialize_;
+    // # of threads to expand the states of a step
+    size_type threads_;
+    
+    // # of expanded states
+    size_type expanded_;
+    
     agenda_type agenda_;
+    agenda_type heaps_;
+    
+    // signatures, terminals and preterminal rules for the input
+    lattice_type lattice_;
+    
+    // team of threads
+    team_ptr_type team_;
     
     // allocator
     state_allocator_type          state_allocator_;
     feature_vector_allocator_type feature_vector_allocator_;
     
+    // features of a successor, scored before materialized
+    feature_buffer_type features_;
+    
     // additional information required by some models...
     tensor_type queue_;
     tensor_type buffer_;
+    tensor_type precomputed_;
+    
+    // batched expansion
+    batch_type  batch_shift_;
+    batch_type  batch_reduce_;
+    batch_type  batch_unary_;
+    tensor_type inputs_;
+    tensor_type layers_;
+    
+    // lazy expansion
+    candidate_set_type candidates_;
+    tensor_type        candidate_layers_;
+    column_map_type    grouped_;
+    category_set_type  categories_;
+    
+    // recombination
+    signature_map_type signatures_;
+    recombined_type    recombined_;
+    heap_type          suffix_;
+    spliced_type       spliced_;
+    
+    // early termination
+    double bound_upper_;
+    double bound_idle_lower_;
+    double bound_idle_upper_;
   };
 };
 
@@ -12,8 +12,19 @@ namespace trance
 {
   namespace parser
   {
+    template <int Hidden=Eigen::Dynamic>
     struct Model4 : public trance::parser::Parser
     {
+      // the operations with the compile-time size of the hidden layer
+      template <int H>
+      struct rebind
+      {
+	typedef Model4<H> type;
+      };
+      
+      // the hidden layer of a state, into which the layer is accumulated without temporaries
+      typedef Eigen::Map<Eigen::Matrix<parameter_type, Hidden, 1> > layer_type;
+      
       template <typename Parser, typename Theta>
       void operation_shift(Parser& parser,
 			   const feature_set_type& feats,
@@ -40,35 +51,34 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state_new.label(),
 						 state_new.head(),
-						 *state_new.feature_vector());
+						 parser.features_);
       
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(label);
 	const size_type offset_category       = theta.offset_category(label);
 
-	if (theta.cache_.rows() && theta.cache_.cols())
-	  state_new.layer(theta.hidden_) = (theta.Bsh_.block(offset_category, 0, theta.hidden_, 1)
-					    + (theta.Wsh_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					       * state.layer(theta.hidden_))
-					    + theta.cache_.block(offset_category, theta.terminal(head), theta.hidden_, 1)
-					    ).array().unaryExpr(model_type::activation());
-	else
-	  state_new.layer(theta.hidden_) = (theta.Bsh_.block(offset_category, 0, theta.hidden_, 1)
-					    + (theta.Wsh_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					       * state.layer(theta.hidden_))
-					    + (theta.Wsh_.block(offset_category, offset2, theta.hidden_, theta.embedding_)
-					       * theta.terminal_.col(theta.terminal(head)))
-					    ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	if (parser.precomputed_.cols()) {
+	  layer = parser.precomputed_.template block<Hidden, 1>(offset_category, state.next(), theta.hidden_, 1);
+	  accumulate<Hidden, Hidden>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	  layer = layer.array().unaryExpr(model_type::activation());
+	} else {
+	  layer = theta.Bsh_.template block<Hidden, 1>(offset_category, 0, theta.hidden_, 1);
+	  accumulate<Hidden, Hidden>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	  accumulate<Hidden, Eigen::Dynamic>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset2, theta.hidden_, theta.embedding_, theta.terminal_.col(theta.terminal(head)));
+	  layer = layer.array().unaryExpr(model_type::activation());
+	}
 	
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
 	
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
       
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -102,31 +112,30 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_reduced;
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state_new.label(),
 						 state.feature_state(),
 						 state_reduced.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
 	  
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(label);
 	const size_type offset_category       = theta.offset_category(label);
 	  
-	state_new.layer(theta.hidden_) = (theta.Bre_.block(offset_category, 0, theta.hidden_, 1)
-					  + (theta.Wre_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					     * state.layer(theta.hidden_))
-					  + (theta.Wre_.block(offset_category, offset2, theta.hidden_, theta.hidden_)
-					     * state_reduced.layer(theta.hidden_))
-					  + (theta.Wre_.block(offset_category, offset3, theta.hidden_, theta.hidden_)
-					     * state_stack.layer(theta.hidden_))
-					  ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	layer = theta.Bre_.template block<Hidden, 1>(offset_category, 0, theta.hidden_, 1);
+	accumulate<Hidden, Hidden>(layer, theta.Wre_, theta.Qre_, theta.Pre_, theta.Lre_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wre_, theta.Qre_, theta.Pre_, theta.Lre_, offset_category, offset2, theta.hidden_, theta.hidden_, state_reduced.layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wre_, theta.Qre_, theta.Pre_, theta.Lre_, offset_category, offset3, theta.hidden_, theta.hidden_, state_stack.layer<Hidden>(theta.hidden_));
+	layer = layer.array().unaryExpr(model_type::activation());
 	  
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
 	  
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
 	  
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -156,28 +165,28 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state_new.label(),
 						 state.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
       
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(label);
 	const size_type offset_category       = theta.offset_category(label);
       
-	state_new.layer(theta.hidden_) = (theta.Bu_.block(offset_category, 0, theta.hidden_, 1)
-					  + (theta.Wu_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					     * state.layer(theta.hidden_))
-					  + (theta.Wu_.block(offset_category, offset2, theta.hidden_, theta.hidden_)
-					     * state.stack().layer(theta.hidden_))
-					    ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	layer = theta.Bu_.template block<Hidden, 1>(offset_category, 0, theta.hidden_, 1);
+	accumulate<Hidden, Hidden>(layer, theta.Wu_, theta.Qu_, theta.Pu_, theta.Lu_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wu_, theta.Qu_, theta.Pu_, theta.Lu_, offset_category, offset2, theta.hidden_, theta.hidden_, state.stack().layer<Hidden>(theta.hidden_));
+	layer = layer.array().unaryExpr(model_type::activation());
       
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
       
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
       
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -203,23 +212,25 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
 
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(symbol_type::FINAL);
       
-	state_new.layer(theta.hidden_) = (theta.Bf_
-					  + theta.Wf_ * state.layer(theta.hidden_)
-					  ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	layer = theta.Bf_.template block<Hidden, 1>(0, 0, theta.hidden_, 1);
+	layer.noalias() += theta.Wf_.template block<Hidden, Hidden>(0, 0, theta.hidden_, theta.hidden_) * state.layer<Hidden>(theta.hidden_);
+	layer = layer.array().unaryExpr(model_type::activation());
       
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
       
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
       
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -245,27 +256,75 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
 
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(symbol_type::IDLE);
       
-	state_new.layer(theta.hidden_) = (theta.Bi_
-					  + theta.Wi_ * state.layer(theta.hidden_)
-					  ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	layer = theta.Bi_.template block<Hidden, 1>(0, 0, theta.hidden_, 1);
+	layer.noalias() += theta.Wi_.template block<Hidden, Hidden>(0, 0, theta.hidden_, theta.hidden_) * state.layer<Hidden>(theta.hidden_);
+	layer = layer.array().unaryExpr(model_type::activation());
       
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
       
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
       
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
       
+      // inputs to the hidden layers by the batched expansion, aligned with the columns of W{sh,re,u}_
+      template <typename Parser, typename Theta>
+      void input_shift(const Parser& parser,
+		       const Theta& theta,
+		       const state_type& state,
+		       const word_type& head,
+		       tensor_type& inputs,
+		       const size_type col) const
+      {
+	const size_type offset1 = 0;
+	const size_type offset2 = theta.hidden_;
+	
+	inputs.block<Hidden, 1>(offset1, col, theta.hidden_, 1) = state.layer<Hidden>(theta.hidden_);
+	inputs.block(offset2, col, theta.embedding_, 1)         = theta.terminal_.col(theta.terminal(head));
+      }
+      
+      template <typename Parser, typename Theta>
+      void input_reduce(const Parser& parser,
+			const Theta& theta,
+			const state_type& state,
+			tensor_type& inputs,
+			const size_type col) const
+      {
+	const size_type offset1 = 0;
+	const size_type offset2 = theta.hidden_;
+	const size_type offset3 = theta.hidden_ + theta.hidden_;
+	
+	inputs.block<Hidden, 1>(offset1, col, theta.hidden_, 1) = state.layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset2, col, theta.hidden_, 1) = state.stack().layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset3, col, theta.hidden_, 1) = state.stack().stack().layer<Hidden>(theta.hidden_);
+      }
+      
+      template <typename Parser, typename Theta>
+      void input_unary(const Parser& parser,
+		       const Theta& theta,
+		       const state_type& state,
+		       tensor_type& inputs,
+		       const size_type col) const
+      {
+	const size_type offset1 = 0;
+	const size_type offset2 = theta.hidden_;
+	
+	inputs.block<Hidden, 1>(offset1, col, theta.hidden_, 1) = state.layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset2, col, theta.hidden_, 1) = state.stack().layer<Hidden>(theta.hidden_);
+      }
+      
       template <typename Parser, typename Theta>
       void operation_axiom(Parser& parser, 
 			   const sentence_type& input,
@@ -287,11 +346,11 @@ namespace trance
 	state_new.derivation() = state_type();
 	state_new.reduced()    = state_type();
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
-						 *state_new.feature_vector());
+						 parser.features_);
 	
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector());
+	state_new.score() = trance::dot_product(theta.Wfe_, parser.features_);
 	state_new.layer(theta.hidden_) = theta.Ba_.array().unaryExpr(model_type::activation());
       
 	parser.agenda_[state_new.step()].push_back(state_new);
@@ -12,8 +12,19 @@ namespace trance
 {
   namespace parser
   {
+    template <int Hidden=Eigen::Dynamic>
     struct Model5 : public trance::parser::Parser
     {
+      // the operations with the compile-time size of the hidden layer
+      template <int H>
+      struct rebind
+      {
+	typedef Model5<H> type;
+      };
+      
+      // the hidden layer of a state, into which the layer is accumulated without temporaries
+      typedef Eigen::Map<Eigen::Matrix<parameter_type, Hidden, 1> > layer_type;
+      
       template <typename Parser, typename Theta>
       void operation_shift(Parser& parser,
 			   const feature_set_type& feats,
@@ -41,39 +52,36 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state_new.label(),
 						 state_new.head(),
-						 *state_new.feature_vector());
+						 parser.features_);
       
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(label);
 	const size_type offset_category       = theta.offset_category(label);
 
-	if (theta.cache_.rows() && theta.cache_.cols())
-	  state_new.layer(theta.hidden_) = (theta.Bsh_.block(offset_category, 0, theta.hidden_, 1)
-					    + (theta.Wsh_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					       * state.layer(theta.hidden_))
-					    + theta.cache_.block(theta.hidden_ + offset_category, theta.terminal(head), theta.hidden_, 1)
-					    + (theta.Wsh_.block(offset_category, offset3, theta.hidden_, theta.hidden_)
-					       * parser.queue_.col(state_new.span().last_ - 1))
-					    ).array().unaryExpr(model_type::activation());
-	else
-	  state_new.layer(theta.hidden_) = (theta.Bsh_.block(offset_category, 0, theta.hidden_, 1)
-					    + (theta.Wsh_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					       * state.layer(theta.hidden_))
-					    + (theta.Wsh_.block(offset_category, offset2, theta.hidden_, theta.embedding_)
-					       * theta.terminal_.col(theta.terminal(head)))
-					    + (theta.Wsh_.block(offset_category, offset3, theta.hidden_, theta.hidden_)
-					       * parser.queue_.col(state_new.span().last_ - 1))
-					    ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
 	
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	if (parser.precomputed_.cols()) {
+	  layer = parser.precomputed_.template block<Hidden, 1>(theta.hidden_ + offset_category, state.next(), theta.hidden_, 1);
+	  accumulate<Hidden, Hidden>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	  accumulate<Hidden, Hidden>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset3, theta.hidden_, theta.hidden_, parser.queue_.template block<Hidden, 1>(0, state_new.span().last_ - 1, theta.hidden_, 1));
+	  layer = layer.array().unaryExpr(model_type::activation());
+	} else {
+	  layer = theta.Bsh_.template block<Hidden, 1>(offset_category, 0, theta.hidden_, 1);
+	  accumulate<Hidden, Hidden>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	  accumulate<Hidden, Eigen::Dynamic>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset2, theta.hidden_, theta.embedding_, theta.terminal_.col(theta.terminal(head)));
+	  accumulate<Hidden, Hidden>(layer, theta.Wsh_, theta.Qsh_, theta.Psh_, theta.Lsh_, offset_category, offset3, theta.hidden_, theta.hidden_, parser.queue_.template block<Hidden, 1>(0, state_new.span().last_ - 1, theta.hidden_, 1));
+	  layer = layer.array().unaryExpr(model_type::activation());
+	}
 	
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
+	
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
       
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -108,33 +116,31 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_reduced;
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state_new.label(),
 						 state.feature_state(),
 						 state_reduced.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
 	  
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(label);
 	const size_type offset_category       = theta.offset_category(label);
 	  
-	state_new.layer(theta.hidden_) = (theta.Bre_.block(offset_category, 0, theta.hidden_, 1)
-					  + (theta.Wre_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					     * state.layer(theta.hidden_))
-					  + (theta.Wre_.block(offset_category, offset2, theta.hidden_, theta.hidden_)
-					     * state_reduced.layer(theta.hidden_))
-					  + (theta.Wre_.block(offset_category, offset3, theta.hidden_, theta.hidden_)
-					     * state_stack.layer(theta.hidden_))
-					  + (theta.Wre_.block(offset_category, offset4, theta.hidden_, theta.hidden_)
-					     * parser.queue_.col(state_new.span().last_))
-					  ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	layer = theta.Bre_.template block<Hidden, 1>(offset_category, 0, theta.hidden_, 1);
+	accumulate<Hidden, Hidden>(layer, theta.Wre_, theta.Qre_, theta.Pre_, theta.Lre_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wre_, theta.Qre_, theta.Pre_, theta.Lre_, offset_category, offset2, theta.hidden_, theta.hidden_, state_reduced.layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wre_, theta.Qre_, theta.Pre_, theta.Lre_, offset_category, offset3, theta.hidden_, theta.hidden_, state_stack.layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wre_, theta.Qre_, theta.Pre_, theta.Lre_, offset_category, offset4, theta.hidden_, theta.hidden_, parser.queue_.template block<Hidden, 1>(0, state_new.span().last_, theta.hidden_, 1));
+	layer = layer.array().unaryExpr(model_type::activation());
 	  
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
 	  
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
 	  
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -165,30 +171,29 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state_new.label(),
 						 state.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
       
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(label);
 	const size_type offset_category       = theta.offset_category(label);
       
-	state_new.layer(theta.hidden_) = (theta.Bu_.block(offset_category, 0, theta.hidden_, 1)
-					  + (theta.Wu_.block(offset_category, offset1, theta.hidden_, theta.hidden_)
-					     * state.layer(theta.hidden_))
-					  + (theta.Wu_.block(offset_category, offset2, theta.hidden_, theta.hidden_)
-					     * state.stack().layer(theta.hidden_))
-					  + (theta.Wu_.block(offset_category, offset3, theta.hidden_, theta.hidden_)
-					     * parser.queue_.col(state_new.span().last_))
-					  ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
 	
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	layer = theta.Bu_.template block<Hidden, 1>(offset_category, 0, theta.hidden_, 1);
+	accumulate<Hidden, Hidden>(layer, theta.Wu_, theta.Qu_, theta.Pu_, theta.Lu_, offset_category, offset1, theta.hidden_, theta.hidden_, state.layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wu_, theta.Qu_, theta.Pu_, theta.Lu_, offset_category, offset2, theta.hidden_, theta.hidden_, state.stack().layer<Hidden>(theta.hidden_));
+	accumulate<Hidden, Hidden>(layer, theta.Wu_, theta.Qu_, theta.Pu_, theta.Lu_, offset_category, offset3, theta.hidden_, theta.hidden_, parser.queue_.template block<Hidden, 1>(0, state_new.span().last_, theta.hidden_, 1));
+	layer = layer.array().unaryExpr(model_type::activation());
 	
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
+	
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
 	
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -214,23 +219,25 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
 
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(symbol_type::FINAL);
       
-	state_new.layer(theta.hidden_) = (theta.Bf_
-					  + theta.Wf_ * state.layer(theta.hidden_)
-					  ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	layer = theta.Bf_.template block<Hidden, 1>(0, 0, theta.hidden_, 1);
+	layer.noalias() += theta.Wf_.template block<Hidden, Hidden>(0, 0, theta.hidden_, theta.hidden_) * state.layer<Hidden>(theta.hidden_);
+	layer = layer.array().unaryExpr(model_type::activation());
       
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
       
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
       
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
@@ -256,27 +263,81 @@ namespace trance
 	state_new.derivation() = state;
 	state_new.reduced()    = state_type();
 	
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
 						 state.feature_state(),
-						 *state_new.feature_vector());
+						 parser.features_);
 
 	const size_type index_operation       = theta.index_operation(state_new.operation());
 	const size_type offset_operation      = index_operation * theta.hidden_;
 	const size_type offset_classification = theta.offset_classification(symbol_type::IDLE);
       
-	state_new.layer(theta.hidden_) = (theta.Bi_
-					  + theta.Wi_ * state.layer(theta.hidden_)
-					  ).array().unaryExpr(model_type::activation());
+	layer_type layer = state_new.layer<Hidden>(theta.hidden_);
+	
+	layer = theta.Bi_.template block<Hidden, 1>(0, 0, theta.hidden_, 1);
+	layer.noalias() += theta.Wi_.template block<Hidden, Hidden>(0, 0, theta.hidden_, theta.hidden_) * state.layer<Hidden>(theta.hidden_);
+	layer = layer.array().unaryExpr(model_type::activation());
       
-	const double score = (theta.Wc_.block(offset_classification, offset_operation, 1, theta.hidden_) * state_new.layer(theta.hidden_)
-			      + theta.Bc_.block(offset_classification, index_operation, 1, 1))(0, 0);
+	const double score = (theta.Wc_.template block<1, Hidden>(offset_classification, offset_operation, 1, theta.hidden_).dot(layer)
+			      + theta.Bc_(offset_classification, index_operation));
       
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector()) + state.score() + score;
+	state_new.score() = score_features(parser, theta, state_new) + state.score() + score;
       
 	parser.agenda_[state_new.step()].push_back(state_new);
       }
       
+      // inputs to the hidden layers by the batched expansion, aligned with the columns of W{sh,re,u}_
+      template <typename Parser, typename Theta>
+      void input_shift(const Parser& parser,
+		       const Theta& theta,
+		       const state_type& state,
+		       const word_type& head,
+		       tensor_type& inputs,
+		       const size_type col) const
+      {
+	const size_type offset1 = 0;
+	const size_type offset2 = theta.hidden_;
+	const size_type offset3 = theta.hidden_ + theta.embedding_;
+	
+	inputs.block<Hidden, 1>(offset1, col, theta.hidden_, 1) = state.layer<Hidden>(theta.hidden_);
+	inputs.block(offset2, col, theta.embedding_, 1)         = theta.terminal_.col(theta.terminal(head));
+	inputs.block<Hidden, 1>(offset3, col, theta.hidden_, 1) = parser.queue_.template block<Hidden, 1>(0, state.next(), theta.hidden_, 1);
+      }
+      
+      template <typename Parser, typename Theta>
+      void input_reduce(const Parser& parser,
+			const Theta& theta,
+			const state_type& state,
+			tensor_type& inputs,
+			const size_type col) const
+      {
+	const size_type offset1 = 0;
+	const size_type offset2 = theta.hidden_;
+	const size_type offset3 = theta.hidden_ + theta.hidden_;
+	const size_type offset4 = theta.hidden_ + theta.hidden_ + theta.hidden_;
+	
+	inputs.block<Hidden, 1>(offset1, col, theta.hidden_, 1) = state.layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset2, col, theta.hidden_, 1) = state.stack().layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset3, col, theta.hidden_, 1) = state.stack().stack().layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset4, col, theta.hidden_, 1) = parser.queue_.template block<Hidden, 1>(0, state.span().last_, theta.hidden_, 1);
+      }
+      
+      template <typename Parser, typename Theta>
+      void input_unary(const Parser& parser,
+		       const Theta& theta,
+		       const state_type& state,
+		       tensor_type& inputs,
+		       const size_type col) const
+      {
+	const size_type offset1 = 0;
+	const size_type offset2 = theta.hidden_;
+	const size_type offset3 = theta.hidden_ + theta.hidden_;
+	
+	inputs.block<Hidden, 1>(offset1, col, theta.hidden_, 1) = state.layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset2, col, theta.hidden_, 1) = state.stack().layer<Hidden>(theta.hidden_);
+	inputs.block<Hidden, 1>(offset3, col, theta.hidden_, 1) = parser.queue_.template block<Hidden, 1>(0, state.span().last_, theta.hidden_, 1);
+      }
+      
       template <typename Parser, typename Theta>
       void operation_axiom(Parser& parser, 
 			   const sentence_type& input,
@@ -292,21 +353,19 @@ namespace trance
 	
 	parser.queue_.col(input_size) = theta.Bqe_.array().unaryExpr(model_type::activation());
 
-	if (theta.cache_.rows() && theta.cache_.cols()) {
-	  for (size_type i = input_size; i; -- i)
-	    parser.queue_.col(i - 1) = (theta.Bqu_
-					+ (theta.Wqu_.block(0, offset1, theta.hidden_, theta.hidden_)
-					   * parser.queue_.col(i))
-					+ theta.cache_.block(0, theta.terminal(input[i - 1]), theta.hidden_, 1)
-					).array().unaryExpr(model_type::activation());
+	if (parser.precomputed_.cols()) {
+	  for (size_type i = input_size; i; -- i) {
+	    parser.queue_.col(i - 1) = parser.precomputed_.template block<Hidden, 1>(0, i - 1, theta.hidden_, 1);
+	    parser.queue_.col(i - 1).noalias() += theta.Wqu_.template block<Hidden, Hidden>(0, offset1, theta.hidden_, theta.hidden_) * parser.queue_.template block<Hidden, 1>(0, i, theta.hidden_, 1);
+	    parser.queue_.col(i - 1) = parser.queue_.col(i - 1).array().unaryExpr(model_type::activation());
+	  }
 	} else {
-	  for (size_type i = input_size; i; -- i)
-	    parser.queue_.col(i - 1) = (theta.Bqu_
-					+ (theta.Wqu_.block(0, offset1, theta.hidden_, theta.hidden_)
-					   * parser.queue_.col(i))
-					+ (theta.Wqu_.block(0, offset2, theta.hidden_, theta.embedding_)
-					   * theta.terminal_.col(theta.terminal(input[i - 1])))
-					).array().unaryExpr(model_type::activation());
+	  for (size_type i = input_size; i; -- i) {
+	    parser.queue_.col(i - 1) = theta.Bqu_.template block<Hidden, 1>(0, 0, theta.hidden_, 1);
+	    parser.queue_.col(i - 1).noalias() += theta.Wqu_.template block<Hidden, Hidden>(0, offset1, theta.hidden_, theta.hidden_) * parser.queue_.template block<Hidden, 1>(0, i, theta.hidden_, 1);
+	    parser.queue_.col(i - 1).noalias() += theta.Wqu_.block(0, offset2, theta.hidden_, theta.embedding_) * theta.terminal_.col(theta.terminal(input[i - 1]));
+	    parser.queue_.col(i - 1) = parser.queue_.col(i - 1).array().unaryExpr(model_type::activation());
+	  }
 	}
 	
 	state_type state_new = parser.state_allocator_.allocate();
@@ -324,11 +383,11 @@ namespace trance
 	state_new.derivation() = state_type();
 	state_new.reduced()    = state_type();
 
-	state_new.feature_vector() = parser.feature_vector_allocator_.allocate();
+	parser.features_.clear();
 	state_new.feature_state()  = feats.apply(state_new.operation(),
-						 *state_new.feature_vector());
+						 parser.features_);
 
-	state_new.score() = trance::dot_product(theta.Wfe_, *state_new.feature_vector());
+	state_new.score() = trance::dot_product(theta.Wfe_, parser.features_);
 	state_new.layer(theta.hidden_) = theta.Ba_.array().unaryExpr(model_type::activation());
       
 	parser.agenda_[state_new.step()].push_back(state_new);
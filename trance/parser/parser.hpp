@@ -40,6 +40,9 @@ namespace trance
       typedef model_type::parameter_type parameter_type;
       typedef model_type::tensor_type    tensor_type;
       typedef model_type::adapted_type   adapted_type;
+      typedef model_type::quantized_type quantized_type;
+      typedef model_type::packed_type    packed_type;
+      typedef model_type::low_rank_type  low_rank_type;
 
       typedef trance::FeatureSet feature_set_type;
       
@@ -49,6 +52,221 @@ namespace trance
 
       typedef state_type::feature_state_type  feature_state_type;
       typedef state_type::feature_vector_type feature_vector_type;
+      typedef feature_set_type::feature_vector_type feature_buffer_type;
+
+    public:
+      // layer += weights.block(row, col, rows, cols) * input, by the low-rank, the quantized or the packed
+      // weights, whichever available first.
+      // The input is a contiguous vector, either a hidden layer, a column of the queue or an embedding.
+      
+      template <int Rows, int Cols, typename Layer, typename Input>
+      static void accumulate(Layer& layer,
+			     const tensor_type& weights,
+			     const quantized_type& quantized,
+			     const packed_type& packed,
+			     const low_rank_type& low_rank,
+			     const size_type row,
+			     const size_type col,
+			     const size_type rows,
+			     const size_type cols,
+			     const Input& input)
+      {
+	if (! low_rank.empty())
+	  low_rank.accumulate(row, col, rows, cols, input.data(), layer.data());
+	else if (! quantized.empty())
+	  quantized.accumulate(row, col, rows, cols, input.data(), layer.data());
+	else if (! packed.empty())
+	  layer.noalias() += packed.panels_.template block<Rows, Cols>(packed.row(row), packed.col(row, col), rows, cols) * input;
+	else
+	  layer.noalias() += weights.template block<Rows, Cols>(row, col, rows, cols) * input;
+      }
+      
+    public:
+      // score the features emitted into the buffer of the parser by the weights addressed by the feature ids, in
+      // addition to the scores of the folded features.
+      // The features are kept as a sparse vector of the state only when the parser materializes them, i.e. when
+      // the features of the derivations are output or the gradients are computed.
+      template <typename Parser, typename Theta>
+      double score_features(Parser& parser, const Theta& theta, state_type& state)
+      {
+	const feature_buffer_type& features = parser.features_;
+	
+	state.feature_vector() = 0;
+	
+	if (features.empty()) return features.score_;
+	
+	if (parser.materialize_) {
+	  state.feature_vector() = parser.feature_vector_allocator_.allocate();
+	  state.feature_vector()->assign(features);
+	}
+	
+	return trance::dot_product(theta.Wfe_, features.begin(), features.end(), features.score_);
+      }
+      
+      // successor states without the hidden layer, which is computed later by the batched expansion.
+      // The score is initialized by the feature score and the score of the previous state.
+      template <typename Parser, typename Theta>
+      state_type state_shift(Parser& parser,
+			     const feature_set_type& feats,
+			     const Theta& theta,
+			     const state_type& state,
+			     const word_type& head,
+			     const symbol_type& label)
+      {
+	state_type state_new = parser.state_allocator_.allocate();
+	
+	state_new.step()  = state.step() + 1;
+	state_new.next()  = state.next() + 1;
+	state_new.unary() = state.unary();
+      
+	state_new.operation() = operation_type::SHIFT;
+	state_new.label()     = label;
+	state_new.head()      = head;
+	state_new.span()      = span_type(state.next(), state.next() + 1);
+      
+	state_new.stack()      = state;
+	state_new.derivation() = state;
+	state_new.reduced()    = state_type();
+	
+	parser.features_.clear();
+	state_new.feature_state()  = feats.apply(state_new.operation(),
+						 state_new.label(),
+						 state_new.head(),
+						 parser.features_);
+	
+	state_new.score() = score_features(parser, theta, state_new) + state.score();
+	
+	parser.agenda_[state_new.step()].push_back(state_new);
+	
+	return state_new;
+      }
+      
+      template <typename Parser, typename Theta>
+      state_type state_reduce(Parser& parser,
+			      const feature_set_type& feats,
+			      const Theta& theta,
+			      const state_type& state,
+			      const symbol_type& label)
+      {
+	const state_type state_reduced = state.stack();
+	const state_type state_stack   = state_reduced.stack();
+	
+	state_type state_new = parser.state_allocator_.allocate();
+	  
+	state_new.step()  = state.step() + 1;
+	state_new.next()  = state.next();
+	state_new.unary() = state.unary();
+	  
+	state_new.operation() = operation_type::REDUCE;
+	state_new.label()     = label;
+	state_new.head()      = symbol_type::EPSILON;
+	state_new.span()      = span_type(state_reduced.span().first_, state.span().last_);
+	  
+	state_new.stack()      = state_stack;
+	state_new.derivation() = state;
+	state_new.reduced()    = state_reduced;
+	
+	parser.features_.clear();
+	state_new.feature_state()  = feats.apply(state_new.operation(),
+						 state_new.label(),
+						 state.feature_state(),
+						 state_reduced.feature_state(),
+						 parser.features_);
+	
+	state_new.score() = score_features(parser, theta, state_new) + state.score();
+	
+	parser.agenda_[state_new.step()].push_back(state_new);
+	
+	return state_new;
+      }
+      
+      template <typename Parser, typename Theta>
+      state_type state_unary(Parser& parser,
+			     const feature_set_type& feats,
+			     const Theta& theta,
+			     const state_type& state,
+			     const symbol_type& label)
+      {
+	state_type state_new = parser.state_allocator_.allocate();
+
+	state_new.step()  = state.step() + 1;
+	state_new.next()  = state.next();
+	state_new.unary() = state.unary() + 1;
+      
+	state_new.operation() = operation_type(operation_type::UNARY, state.operation().closure() + 1);
+	state_new.label()     = label;
+	state_new.head()      = symbol_type::EPSILON;
+	state_new.span()      = state.span();
+      
+	state_new.stack()      = state.stack();
+	state_new.derivation() = state;
+	state_new.reduced()    = state_type();
+	
+	parser.features_.clear();
+	state_new.feature_state()  = feats.apply(state_new.operation(),
+						 state_new.label(),
+						 state.feature_state(),
+						 parser.features_);
+	
+	state_new.score() = score_features(parser, theta, state_new) + state.score();
+	
+	parser.agenda_[state_new.step()].push_back(state_new);
+	
+	return state_new;
+      }
+
+    public:
+      // feature scores of successor states without allocating them, used by the lazy expansion.
+      // The features are emitted into the scratch feature buffer, and the feature state is discarded.
+      
+      template <typename Theta>
+      double score_shift(const feature_set_type& feats,
+			 const Theta& theta,
+			 const word_type& head,
+			 const symbol_type& label,
+			 feature_buffer_type& features) const
+      {
+	features.clear();
+	
+	const_cast<feature_set_type&>(feats).deallocate(feats.apply(operation_type::SHIFT, label, head, features));
+	
+	return trance::dot_product(theta.Wfe_, features.begin(), features.end(), features.score_);
+      }
+      
+      template <typename Theta>
+      double score_reduce(const feature_set_type& feats,
+			  const Theta& theta,
+			  const state_type& state,
+			  const symbol_type& label,
+			  feature_buffer_type& features) const
+      {
+	features.clear();
+	
+	const_cast<feature_set_type&>(feats).deallocate(feats.apply(operation_type::REDUCE,
+								    label,
+								    state.feature_state(),
+								    state.stack().feature_state(),
+								    features));
+	
+	return trance::dot_product(theta.Wfe_, features.begin(), features.end(), features.score_);
+      }
+      
+      template <typename Theta>
+      double score_unary(const feature_set_type& feats,
+			 const Theta& theta,
+			 const state_type& state,
+			 const symbol_type& label,
+			 feature_buffer_type& features) const
+      {
+	features.clear();
+	
+	const_cast<feature_set_type&>(feats).deallocate(feats.apply(operation_type(operation_type::UNARY, state.operation().closure() + 1),
+								    label,
+								    state.feature_state(),
+								    features));
+	
+	return trance::dot_product(theta.Wfe_, features.begin(), features.end(), features.score_);
+      }
     };
   };
 };
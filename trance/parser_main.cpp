@@ -0,0 +1,215 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+// verify that the operations of the parser do not allocate from the heap once warmed up.
+// The allocations are counted by the replaced operator new and by the bytes in use reported by malloc_stats
+// around each operation. Each sentence is parsed twice by randomized models: the first parse warms up the
+// state allocator and the storage of the agenda, and the operations of the second parse are counted.
+
+#include <new>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <boost/random.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "parser.hpp"
+#include "model_traits.hpp"
+
+#include "utils/malloc_stats.hpp"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+  ++ allocations;
+
+  void* p = std::malloc(size ? size : 1);
+  if (! p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) throw()
+{
+  std::free(p);
+}
+
+struct counter_type
+{
+  counter_type() : operations_(0), failures_(0) {}
+
+  size_t operations_;
+  size_t failures_;
+};
+
+// count the allocations of an operation
+struct allocation_scope
+{
+  allocation_scope(counter_type& counter)
+    : counter_(counter), allocations_(allocations), used_(utils::malloc_stats::used()) {}
+  ~allocation_scope()
+  {
+    ++ counter_.operations_;
+    counter_.failures_ += (allocations != allocations_ || utils::malloc_stats::used() != used_);
+  }
+
+  counter_type& counter_;
+  size_t allocations_;
+  size_t used_;
+};
+
+// the operations of Impl, counted when enabled
+template <typename Impl>
+struct Counted : public Impl
+{
+  typedef typename Impl::feature_set_type feature_set_type;
+  typedef typename Impl::state_type       state_type;
+  typedef typename Impl::word_type        word_type;
+  typedef typename Impl::symbol_type      symbol_type;
+
+  Counted(bool& enabled, counter_type& shift, counter_type& reduce, counter_type& unary)
+    : enabled_(enabled), shift_(shift), reduce_(reduce), unary_(unary) {}
+
+  template <typename Parser, typename Theta>
+  void operation_shift(Parser& parser,
+		       const feature_set_type& feats,
+		       const Theta& theta,
+		       const state_type& state,
+		       const word_type& head,
+		       const symbol_type& label)
+  {
+    if (! enabled_)
+      Impl::operation_shift(parser, feats, theta, state, head, label);
+    else {
+      allocation_scope scope(shift_);
+
+      Impl::operation_shift(parser, feats, theta, state, head, label);
+    }
+  }
+
+  template <typename Parser, typename Theta>
+  void operation_reduce(Parser& parser,
+			const feature_set_type& feats,
+			const Theta& theta,
+			const state_type& state,
+			const symbol_type& label)
+  {
+    if (! enabled_)
+      Impl::operation_reduce(parser, feats, theta, state, label);
+    else {
+      allocation_scope scope(reduce_);
+
+      Impl::operation_reduce(parser, feats, theta, state, label);
+    }
+  }
+
+  template <typename Parser, typename Theta>
+  void operation_unary(Parser& parser,
+		       const feature_set_type& feats,
+		       const Theta& theta,
+		       const state_type& state,
+		       const symbol_type& label)
+  {
+    if (! enabled_)
+      Impl::operation_unary(parser, feats, theta, state, label);
+    else {
+      allocation_scope scope(unary_);
+
+      Impl::operation_unary(parser, feats, theta, state, label);
+    }
+  }
+
+  bool& enabled_;
+  counter_type& shift_;
+  counter_type& reduce_;
+  counter_type& unary_;
+};
+
+template <typename Theta, typename Impl>
+size_t verify(const std::string& name,
+	      const trance::Grammar& grammar,
+	      const trance::Signature& signature,
+	      const std::vector<trance::Sentence>& sentences,
+	      const size_t hidden)
+{
+  Theta theta(hidden, 32, grammar);
+
+  boost::mt19937 gen;
+  gen.seed(1234);
+  theta.random(gen);
+
+  trance::FeatureSet feats;
+  trance::Parser parser(32, 3);
+  trance::Parser::derivation_set_type derivations;
+
+  parser.materialize_ = false;
+
+  bool enabled = false;
+  counter_type shift;
+  counter_type reduce;
+  counter_type unary;
+
+  const Counted<Impl> impl(enabled, shift, reduce, unary);
+
+  for (size_t i = 0; i != sentences.size(); ++ i) {
+    enabled = false;
+    parser.search(impl, sentences[i], grammar, signature, feats, theta, 1, derivations, trance::Parser::best_action_none());
+
+    enabled = true;
+    parser.search(impl, sentences[i], grammar, signature, feats, theta, 1, derivations, trance::Parser::best_action_none());
+  }
+
+  std::cerr << name << " hidden: " << hidden
+	    << " shift: " << shift.failures_ << '/' << shift.operations_
+	    << " reduce: " << reduce.failures_ << '/' << reduce.operations_
+	    << " unary: " << unary.failures_ << '/' << unary.operations_
+	    << std::endl;
+
+  return shift.failures_ + reduce.failures_ + unary.failures_;
+}
+
+template <typename Theta>
+size_t verify(const std::string& name,
+	      const trance::Grammar& grammar,
+	      const trance::Signature& signature,
+	      const std::vector<trance::Sentence>& sentences)
+{
+  typedef typename trance::model_traits<Theta>::parser_type impl_type;
+
+  return (verify<Theta, typename impl_type::template rebind<64>::type>(name, grammar, signature, sentences, 64)
+	  + verify<Theta, impl_type>(name, grammar, signature, sentences, 48));
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2 && argc != 3) {
+    std::cerr << argv[0] << " grammar-file [signature]" << std::endl;
+    return 1;
+  }
+
+  trance::Grammar grammar(argv[1]);
+
+  boost::shared_ptr<trance::Signature> signature(trance::Signature::create(argc == 3 ? argv[2] : "none"));
+
+  std::vector<trance::Sentence> sentences;
+
+  trance::Sentence sentence;
+  while (std::cin >> sentence)
+    if (! sentence.empty())
+      sentences.push_back(sentence);
+
+  size_t failures = 0;
+  failures += verify<trance::model::Model1>("model1", grammar, *signature, sentences);
+  failures += verify<trance::model::Model2>("model2", grammar, *signature, sentences);
+  failures += verify<trance::model::Model3>("model3", grammar, *signature, sentences);
+  failures += verify<trance::model::Model4>("model4", grammar, *signature, sentences);
+  failures += verify<trance::model::Model5>("model5", grammar, *signature, sentences);
+
+  if (failures)
+    std::cerr << "operations with heap allocations: " << failures << std::endl;
+
+  return failures != 0;
+}
@@ -65,6 +65,10 @@ namespace trance
       if (oracle_.sentence_.empty()) return;
       
       initialize(oracle_.sentence_, feats, theta);
+      
+      lattice_.assign(oracle_.sentence_, grammar, signature, theta);
+      
+      precompute(theta);
 
       if (oracle_.actions_.size() >= agenda_.size())
 	throw std::runtime_error("oracle operation sequence is longer than agenda size!");
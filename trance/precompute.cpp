@@ -0,0 +1,347 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "precompute.hpp"
+
+#include "utils/bithack.hpp"
+
+namespace trance
+{
+  void Precompute::assign(tensor_type& columns)
+  {
+    clear();
+
+    rows_ = columns.rows();
+    columns_.swap(columns);
+  }
+
+  void Precompute::assign(const size_type rows,
+			  const size_type words,
+			  const size_type capacity,
+			  const size_type shards)
+  {
+    clear();
+
+    if (! rows || ! shards)
+      throw std::runtime_error("invalid precompute cache");
+
+    rows_ = rows;
+    shards_.reset(new shard_set_type(shards));
+
+    const size_type capacity_shard = utils::bithack::max(size_type(1), capacity / (sizeof(parameter_type) * rows * shards));
+
+    for (size_type i = 0; i != shards; ++ i) {
+      shard_type& shard = (*shards_)[i];
+
+      shard.index_.resize((words + shards - 1) / shards, 0);
+      shard.capacity_ = utils::bithack::min(capacity_shard, shard.index_.size());
+
+      shard.words_.reserve(shard.capacity_);
+      shard.referenced_.reserve(shard.capacity_);
+      shard.columns_.reserve(shard.capacity_ * rows);
+    }
+  }
+
+  // header of the shared memory segment, followed by the words of the columns and the aligned columns
+  struct PrecomputeHeader
+  {
+    char     magic_[8];
+    uint64_t version_;
+    uint64_t rows_;
+    uint64_t cols_;
+    uint64_t offset_;
+  };
+
+  static const char     precompute_magic[8] = {'T', 'R', 'A', 'N', 'C', 'E', 'P', 'C'};
+  static const uint64_t precompute_version   = 1;
+  static const size_t   precompute_alignment = 64;
+
+  static inline
+  std::string precompute_name(const std::string& name)
+  {
+    if (name.empty())
+      throw std::runtime_error("no shared memory name?");
+
+    return (name[0] == '/' ? name : '/' + name);
+  }
+
+  static inline
+  std::string precompute_error(const std::string& message, const std::string& name)
+  {
+    return message + ": " + name + ": " + std::strerror(errno);
+  }
+
+  Precompute::Segment::~Segment()
+  {
+    if (data_)
+      ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  bool Precompute::find(const size_type word, parameter_type* column) const
+  {
+    if (segment_) {
+      if (word >= index_.size() || ! index_[word])
+	return false;
+
+      const parameter_type* shared = shared_ + (index_[word] - 1) * rows_;
+
+      std::copy(shared, shared + rows_, column);
+      return true;
+    }
+
+    if (! shards_) {
+      std::copy(columns_.col(word).data(), columns_.col(word).data() + rows_, column);
+      return true;
+    }
+
+    shard_type& shard = (*shards_)[word % shards_->size()];
+    const size_type pos = word / shards_->size();
+
+    shard_type::lock_type lock(shard.spinlock_);
+
+    const size_type slot = shard.index_[pos];
+
+    if (! slot) {
+      ++ shard.statistics_.misses_;
+      return false;
+    }
+
+    ++ shard.statistics_.hits_;
+    shard.referenced_[slot - 1] = true;
+
+    std::copy(&shard.columns_[(slot - 1) * rows_], &shard.columns_[(slot - 1) * rows_] + rows_, column);
+
+    return true;
+  }
+
+  void Precompute::insert(const size_type word, const parameter_type* column) const
+  {
+    if (! shards_) return;
+
+    shard_type& shard = (*shards_)[word % shards_->size()];
+    const size_type pos = word / shards_->size();
+
+    shard_type::lock_type lock(shard.spinlock_);
+
+    // another thread may have inserted the same word
+    if (shard.index_[pos]) return;
+
+    size_type slot = shard.words_.size();
+
+    if (slot < shard.capacity_) {
+      shard.words_.push_back(pos);
+      shard.referenced_.push_back(false);
+      shard.columns_.resize(shard.columns_.size() + rows_);
+    } else {
+      // CLOCK: clear the reference bits until we find a slot not referenced
+      while (shard.referenced_[shard.hand_]) {
+	shard.referenced_[shard.hand_] = false;
+	shard.hand_ = (shard.hand_ + 1) % shard.capacity_;
+      }
+
+      slot = shard.hand_;
+      shard.hand_ = (shard.hand_ + 1) % shard.capacity_;
+
+      shard.index_[shard.words_[slot]] = 0;
+      shard.words_[slot] = pos;
+
+      ++ shard.statistics_.evictions_;
+    }
+
+    shard.index_[pos] = slot + 1;
+    shard.referenced_[slot] = false;
+
+    std::copy(column, column + rows_, &shard.columns_[slot * rows_]);
+  }
+
+  Precompute::statistics_type Precompute::statistics() const
+  {
+    statistics_type statistics;
+
+    if (segment_) {
+      for (size_type i = 0; i != index_.size(); ++ i)
+	statistics.columns_ += (index_[i] != 0);
+      return statistics;
+    }
+
+    if (! shards_) {
+      statistics.columns_ = columns_.cols();
+      return statistics;
+    }
+
+    for (size_type i = 0; i != shards_->size(); ++ i) {
+      shard_type& shard = (*shards_)[i];
+
+      shard_type::lock_type lock(shard.spinlock_);
+
+      statistics += shard.statistics_;
+      statistics.columns_ += shard.words_.size();
+    }
+
+    return statistics;
+  }
+
+  void Precompute::publish(const std::string& name, const terminal_set_type& vocab) const
+  {
+    if (shards_ || segment_ || ! rows_)
+      throw std::runtime_error("only the columns computed in advance can be published");
+
+    const std::string path = precompute_name(name);
+    const size_type cols = columns_.cols();
+
+    // the words, empty for the columns not in the vocabulary
+    size_type offset = sizeof(PrecomputeHeader);
+    for (size_type id = 0; id != cols; ++ id)
+      offset += sizeof(uint64_t) + (id < vocab.size() && vocab[id] ? word_type(id).size() : 0);
+
+    offset = (offset + precompute_alignment - 1) / precompute_alignment * precompute_alignment;
+
+    const size_type size = offset + sizeof(parameter_type) * rows_ * cols;
+
+    const int fd = ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+      throw std::runtime_error(precompute_error("unable to create shared memory", path));
+
+    if (::ftruncate(fd, size) < 0) {
+      const std::string error = precompute_error("unable to allocate shared memory", path);
+      ::close(fd);
+      ::shm_unlink(path.c_str());
+      throw std::runtime_error(error);
+    }
+
+    void* mapped = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) {
+      const std::string error = precompute_error("unable to map shared memory", path);
+      ::shm_unlink(path.c_str());
+      throw std::runtime_error(error);
+    }
+
+    char* data = static_cast<char*>(mapped);
+
+    PrecomputeHeader header;
+    std::memcpy(header.magic_, precompute_magic, sizeof(precompute_magic));
+    header.version_ = precompute_version;
+    header.rows_    = rows_;
+    header.cols_    = cols;
+    header.offset_  = offset;
+
+    std::memcpy(data, &header, sizeof(header));
+
+    char* iter = data + sizeof(header);
+    for (size_type id = 0; id != cols; ++ id) {
+      const uint64_t word_size = (id < vocab.size() && vocab[id] ? word_type(id).size() : 0);
+
+      std::memcpy(iter, &word_size, sizeof(uint64_t));
+      iter += sizeof(uint64_t);
+
+      if (word_size) {
+	std::memcpy(iter, &(*word_type(id).begin()), word_size);
+	iter += word_size;
+      }
+    }
+
+    std::memcpy(data + offset, columns_.data(), sizeof(parameter_type) * rows_ * cols);
+
+    ::munmap(mapped, size);
+  }
+
+  void Precompute::attach(const std::string& name, const size_type rows)
+  {
+    clear();
+
+    const std::string path = precompute_name(name);
+
+    const int fd = ::shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      throw std::runtime_error(precompute_error("unable to open shared memory", path));
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      const std::string error = precompute_error("unable to stat shared memory", path);
+      ::close(fd);
+      throw std::runtime_error(error);
+    }
+
+    const size_type size = st.st_size;
+
+    if (size < sizeof(PrecomputeHeader)) {
+      ::close(fd);
+      throw std::runtime_error("invalid shared memory: " + path);
+    }
+
+    void* mapped = ::mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED)
+      throw std::runtime_error(precompute_error("unable to map shared memory", path));
+
+    segment_ptr_type segment(new segment_type());
+    segment->data_ = static_cast<const char*>(mapped);
+    segment->size_ = size;
+
+    PrecomputeHeader header;
+    std::memcpy(&header, segment->data_, sizeof(header));
+
+    if (std::memcmp(header.magic_, precompute_magic, sizeof(precompute_magic)) != 0
+	|| header.version_ != precompute_version)
+      throw std::runtime_error("invalid shared memory: " + path);
+    if (header.rows_ != rows)
+      throw std::runtime_error("shared memory does not match the model: " + path);
+    if (header.offset_ % precompute_alignment != 0
+	|| header.offset_ + sizeof(parameter_type) * header.rows_ * header.cols_ > size)
+      throw std::runtime_error("invalid shared memory: " + path);
+
+    // map the words of this process to the columns
+    index_set_type index;
+
+    const char* iter = segment->data_ + sizeof(header);
+    const char* last = segment->data_ + header.offset_;
+
+    for (size_type col = 0; col != header.cols_; ++ col) {
+      uint64_t word_size = 0;
+
+      if (iter + sizeof(uint64_t) > last)
+	throw std::runtime_error("invalid shared memory: " + path);
+
+      std::memcpy(&word_size, iter, sizeof(uint64_t));
+      iter += sizeof(uint64_t);
+
+      if (! word_size) continue;
+
+      if (iter + word_size > last)
+	throw std::runtime_error("invalid shared memory: " + path);
+
+      const word_type word(utils::piece(iter, iter + word_size));
+      iter += word_size;
+
+      if (word.id() >= index.size())
+	index.resize(word.id() + 1, 0);
+
+      index[word.id()] = col + 1;
+    }
+
+    index_.swap(index);
+
+    rows_    = rows;
+    shared_  = reinterpret_cast<const parameter_type*>(segment->data_ + header.offset_);
+    segment_ = segment;
+  }
+
+  bool Precompute::remove(const std::string& name)
+  {
+    return ::shm_unlink(precompute_name(name).c_str()) == 0;
+  }
+};
@@ -0,0 +1,198 @@
+// -*- mode: c++ -*-
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#ifndef __TRANCE__PRECOMPUTE__HPP__
+#define __TRANCE__PRECOMPUTE__HPP__ 1
+
+//
+// precomputed columns of the terms which depend only on the word
+//
+// Either all the columns are computed in advance, or they are computed on demand and kept in a
+// sharded cache bounded by its memory size, from which the columns are evicted by the CLOCK algorithm.
+// Columns are copied in and out under the lock of the shard, thus an eviction never invalidates
+// a column in use.
+//
+// The columns computed in advance can be published to a named POSIX shared memory segment, to which
+// other processes attach read-only. The segment keeps the word of each column, since the word ids
+// differ by process. Only the columns are shared: the weights of the model are loaded by each process.
+//
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <boost/shared_ptr.hpp>
+
+#include <trance/symbol.hpp>
+
+#include <utils/spinlock.hpp>
+
+namespace trance
+{
+  class Precompute
+  {
+  public:
+    typedef size_t    size_type;
+    typedef ptrdiff_t difference_type;
+    typedef float     parameter_type;
+
+    typedef Symbol word_type;
+
+    typedef Eigen::Matrix<parameter_type, Eigen::Dynamic, Eigen::Dynamic> tensor_type;
+
+    typedef std::vector<bool, std::allocator<bool> > terminal_set_type;
+
+    struct Statistics
+    {
+      Statistics() : hits_(0), misses_(0), evictions_(0), columns_(0) {}
+
+      Statistics& operator+=(const Statistics& x)
+      {
+	hits_      += x.hits_;
+	misses_    += x.misses_;
+	evictions_ += x.evictions_;
+	columns_   += x.columns_;
+	return *this;
+      }
+
+      size_type hits_;
+      size_type misses_;
+      size_type evictions_;
+      size_type columns_;
+    };
+
+    typedef Statistics statistics_type;
+
+  private:
+    struct Shard
+    {
+      typedef utils::spinlock spinlock_type;
+      typedef spinlock_type::scoped_lock lock_type;
+
+      typedef std::vector<parameter_type, std::allocator<parameter_type> > column_set_type;
+      typedef std::vector<uint32_t, std::allocator<uint32_t> >             index_set_type;
+      typedef std::vector<char, std::allocator<char> >                     reference_set_type;
+
+      Shard() : capacity_(0), hand_(0) {}
+
+      spinlock_type spinlock_;
+
+      // slot + 1 for each word in this shard, or zero
+      index_set_type index_;
+
+      // the words, the reference bits and the columns of the slots
+      index_set_type     words_;
+      reference_set_type referenced_;
+      column_set_type    columns_;
+
+      size_type capacity_;
+      size_type hand_;
+
+      statistics_type statistics_;
+    };
+
+    typedef Shard shard_type;
+    typedef std::vector<shard_type, std::allocator<shard_type> > shard_set_type;
+    typedef boost::shared_ptr<shard_set_type> shard_ptr_type;
+
+    // mapped shared memory segment, unmapped when the last reference is gone
+    struct Segment
+    {
+      Segment() : data_(0), size_(0) {}
+      ~Segment();
+
+      const char* data_;
+      size_type   size_;
+    };
+
+    typedef Segment segment_type;
+    typedef boost::shared_ptr<segment_type> segment_ptr_type;
+
+    typedef std::vector<uint32_t, std::allocator<uint32_t> > index_set_type;
+
+  public:
+    Precompute() : rows_(0), shared_(0) {}
+
+  public:
+    // all the columns computed in advance
+    void assign(tensor_type& columns);
+
+    // columns computed on demand, bounded by the capacity in bytes
+    void assign(const size_type rows,
+		const size_type words,
+		const size_type capacity,
+		const size_type shards=64);
+
+    // copy the column of the word. Returns false if the column is not cached.
+    bool find(const size_type word, parameter_type* column) const;
+
+    // cache the column of the word
+    void insert(const size_type word, const parameter_type* column) const;
+
+    statistics_type statistics() const;
+
+    // publish the columns computed in advance to the shared memory segment of the name.
+    // vocab is the terminal set of the model, labelling each column.
+    void publish(const std::string& name, const terminal_set_type& vocab) const;
+
+    // attach to the shared memory segment of the name, whose columns must have the rows
+    void attach(const std::string& name, const size_type rows);
+
+    // remove the shared memory segment. The processes attached to it keep their mappings.
+    static bool remove(const std::string& name);
+
+  public:
+    size_type rows() const { return rows_; }
+    bool empty() const { return rows_ == 0; }
+    bool lazy() const { return shards_.get(); }
+    bool shared() const { return segment_.get(); }
+
+    void clear()
+    {
+      rows_ = 0;
+      columns_.resize(0, 0);
+      shards_.reset();
+
+      segment_.reset();
+      shared_ = 0;
+      index_.clear();
+    }
+
+    void swap(Precompute& x)
+    {
+      std::swap(rows_, x.rows_);
+      columns_.swap(x.columns_);
+      shards_.swap(x.shards_);
+
+      segment_.swap(x.segment_);
+      std::swap(shared_, x.shared_);
+      index_.swap(x.index_);
+    }
+
+  private:
+    size_type      rows_;
+    tensor_type    columns_;
+    shard_ptr_type shards_;
+
+    // columns in the shared memory segment, and column + 1 for each word, or zero
+    segment_ptr_type      segment_;
+    const parameter_type* shared_;
+    index_set_type        index_;
+  };
+};
+
+namespace std
+{
+  inline
+  void swap(trance::Precompute& x, trance::Precompute& y)
+  {
+    x.swap(y);
+  }
+};
+
+#endif
@@ -0,0 +1,369 @@
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include "quantized.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include "utils/compress_stream.hpp"
+#include "utils/bithack.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRANCE_QUANTIZED_X86 1
+#include <immintrin.h>
+#endif
+
+namespace trance
+{
+  // we use at most 15 bits for the input vector so that the int32 sums never overflow
+  static const Quantized::size_type quantized_chunk = 256;
+  static const float quantized_input_max = 32767.0f;
+
+  static inline
+  uint16_t float_to_half(const float& value)
+  {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign     = (bits >> 16) & 0x8000;
+    const int32_t  exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t       mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff)
+      return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+      return sign | 0x7c00;
+
+    if (exponent <= 0) {
+      // subnormal
+      if (exponent < -10)
+	return sign;
+
+      mantissa |= 0x800000;
+
+      const int shift = 14 - exponent;
+      const uint32_t remainder = mantissa & ((uint32_t(1) << shift) - 1);
+      const uint32_t middle    = uint32_t(1) << (shift - 1);
+
+      uint32_t half = mantissa >> shift;
+      if (remainder > middle || (remainder == middle && (half & 1)))
+	++ half;
+
+      return sign | half;
+    }
+
+    // round to the nearest even. The carry may overflow into the exponent, which is intended.
+    uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+      ++ half;
+
+    return sign | half;
+  }
+
+  static inline
+  float half_to_float(const uint16_t& half)
+  {
+    const uint32_t sign     = uint32_t(half & 0x8000) << 16;
+    uint32_t       exponent = (half >> 10) & 0x1f;
+    uint32_t       mantissa = half & 0x3ff;
+    uint32_t       bits;
+
+    if (exponent == 0) {
+      if (mantissa == 0)
+	bits = sign;
+      else {
+	// subnormal
+	exponent = 127 - 15 + 1;
+	while (! (mantissa & 0x400)) {
+	  mantissa <<= 1;
+	  -- exponent;
+	}
+	bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+      }
+    } else if (exponent == 31)
+      bits = sign | 0x7f800000 | (mantissa << 13);
+    else
+      bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  static
+  int32_t dot_int8_generic(const int8_t* w, const int16_t* x, const size_t n)
+  {
+    int32_t sum = 0;
+    for (size_t i = 0; i != n; ++ i)
+      sum += int32_t(w[i]) * x[i];
+    return sum;
+  }
+
+  static
+  float dot_fp16_generic(const uint16_t* w, const float* x, const size_t n)
+  {
+    float sum = 0;
+    for (size_t i = 0; i != n; ++ i)
+      sum += half_to_float(w[i]) * x[i];
+    return sum;
+  }
+
+#ifdef TRANCE_QUANTIZED_X86
+  __attribute__((target("avx2")))
+  static
+  int32_t dot_int8_avx2(const int8_t* w, const int16_t* x, const size_t n)
+  {
+    __m256i acc = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (/**/; i + 16 <= n; i += 16) {
+      const __m256i ww = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (w + i)));
+      const __m256i xx = _mm256_loadu_si256((const __m256i*) (x + i));
+
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(ww, xx));
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+
+    // we do not call the generic code with the upper halves of the registers in use
+    int32_t result = _mm_cvtsi128_si32(sum);
+    for (/**/; i != n; ++ i)
+      result += int32_t(w[i]) * x[i];
+
+    return result;
+  }
+
+  __attribute__((target("avx2,fma,f16c")))
+  static
+  float dot_fp16_avx2(const uint16_t* w, const float* x, const size_t n)
+  {
+    __m256 acc = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (/**/; i + 8 <= n; i += 8)
+      acc = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (w + i))), _mm256_loadu_ps(x + i), acc);
+
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+
+    float result = _mm_cvtss_f32(sum);
+    for (/**/; i != n; ++ i)
+      result += _cvtsh_ss(w[i]) * x[i];
+
+    return result;
+  }
+#endif
+
+  typedef int32_t (*dot_int8_type)(const int8_t*, const int16_t*, const size_t);
+  typedef float   (*dot_fp16_type)(const uint16_t*, const float*, const size_t);
+
+  static dot_int8_type select_int8()
+  {
+#ifdef TRANCE_QUANTIZED_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return dot_int8_avx2;
+#endif
+    return dot_int8_generic;
+  }
+
+  static dot_fp16_type select_fp16()
+  {
+#ifdef TRANCE_QUANTIZED_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+      return dot_fp16_avx2;
+#endif
+    return dot_fp16_generic;
+  }
+
+  static const dot_int8_type dot_int8 = select_int8();
+  static const dot_fp16_type dot_fp16 = select_fp16();
+
+  Quantized::precision_type Quantized::precision(const std::string& name)
+  {
+    if (name.empty() || name == "none")
+      return NONE;
+    else if (name == "int8")
+      return INT8;
+    else if (name == "fp16")
+      return FP16;
+    else
+      throw std::runtime_error("unsupported quantization: " + name);
+  }
+
+  std::string Quantized::name(const precision_type& precision)
+  {
+    switch (precision) {
+    case INT8: return "int8";
+    case FP16: return "fp16";
+    default:   return "none";
+    }
+  }
+
+  void Quantized::assign(const tensor_type& matrix, const precision_type& precision)
+  {
+    clear();
+
+    if (precision == NONE) return;
+
+    precision_ = precision;
+    rows_ = matrix.rows();
+    cols_ = matrix.cols();
+
+    if (precision_ == INT8) {
+      int8_.resize(rows_ * cols_);
+      scale_.resize(rows_);
+
+      for (size_type row = 0; row != rows_; ++ row) {
+	const parameter_type norm = matrix.row(row).lpNorm<Eigen::Infinity>();
+
+	scale_[row] = norm / 127;
+
+	const parameter_type factor = (norm == 0 ? parameter_type(0) : 127 / norm);
+
+	for (size_type col = 0; col != cols_; ++ col)
+	  int8_[row * cols_ + col] = std::max(-127L, std::min(127L, std::lrint(matrix(row, col) * factor)));
+      }
+    } else {
+      half_.resize(rows_ * cols_);
+
+      for (size_type row = 0; row != rows_; ++ row)
+	for (size_type col = 0; col != cols_; ++ col)
+	  half_[row * cols_ + col] = float_to_half(matrix(row, col));
+    }
+  }
+
+  void Quantized::accumulate(const size_type row,
+			     const size_type col,
+			     const size_type rows,
+			     const size_type cols,
+			     const parameter_type* x,
+			     parameter_type* y) const
+  {
+    if (precision_ == INT8) {
+      int16_t input[quantized_chunk];
+
+      // we quantize the input by chunks, each of which has its own scale
+      for (size_type first = 0; first < cols; first += quantized_chunk) {
+	const size_type size = utils::bithack::min(quantized_chunk, cols - first);
+
+	parameter_type norm = 0;
+	for (size_type i = 0; i != size; ++ i)
+	  norm = std::max(norm, std::fabs(x[first + i]));
+
+	if (norm == 0) continue;
+
+	const parameter_type factor = quantized_input_max / norm;
+	const parameter_type scale  = norm / quantized_input_max;
+
+	for (size_type i = 0; i != size; ++ i)
+	  input[i] = std::lrint(x[first + i] * factor);
+
+	const int8_t* weights = &int8_[row * cols_ + col + first];
+
+	for (size_type i = 0; i != rows; ++ i, weights += cols_)
+	  y[i] += scale_[row + i] * scale * dot_int8(weights, input, size);
+      }
+    } else if (precision_ == FP16) {
+      const uint16_t* weights = &half_[row * cols_ + col];
+
+      for (size_type i = 0; i != rows; ++ i, weights += cols_)
+	y[i] += dot_fp16(weights, x, cols);
+    } else
+      throw std::runtime_error("no quantized weights");
+  }
+
+  void Quantized::write(const path_type& path,
+			const category_set_type& categories,
+			const size_type block) const
+  {
+    if (rows_ % block != 0)
+      throw std::runtime_error("rows does not match");
+
+    const size_type num_labels = utils::bithack::min(categories.size(), static_cast<size_type>(rows_ / block));
+
+    utils::compress_ostream os(path, 1024 * 1024);
+
+    os.write((char*) &cols_, sizeof(size_type));
+    os.write((char*) &block, sizeof(size_type));
+
+    for (size_type i = 0; i != num_labels; ++ i)
+      if (categories[i] != category_type()) {
+	const size_type label_size = categories[i].size();
+
+	os.write((char*) &label_size, sizeof(size_type));
+	os.write((char*) &(*categories[i].begin()), label_size);
+
+	if (precision_ == INT8) {
+	  os.write((char*) &scale_[block * i], sizeof(parameter_type) * block);
+	  os.write((char*) &int8_[block * i * cols_], sizeof(int8_t) * block * cols_);
+	} else
+	  os.write((char*) &half_[block * i * cols_], sizeof(uint16_t) * block * cols_);
+      }
+  }
+
+  void Quantized::read(const path_type& path,
+		       const precision_type& precision,
+		       const size_type rows,
+		       const size_type cols,
+		       const size_type block)
+  {
+    clear();
+
+    if (precision == NONE) return;
+
+    if (path != "-" && ! boost::filesystem::exists(path))
+      throw std::runtime_error("no quantized matrix: " + path.string());
+
+    utils::compress_istream is(path, 1024 * 1024);
+
+    size_type cols_file  = 0;
+    size_type block_file = 0;
+
+    is.read((char*) &cols_file,  sizeof(size_type));
+    is.read((char*) &block_file, sizeof(size_type));
+
+    if (cols_file != cols || block_file != block)
+      throw std::runtime_error("quantized matrix does not match: " + path.string());
+
+    precision_ = precision;
+    rows_ = rows;
+    cols_ = cols;
+
+    if (precision_ == INT8) {
+      int8_.resize(rows_ * cols_, 0);
+      scale_.resize(rows_, 0);
+    } else
+      half_.resize(rows_ * cols_, 0);
+
+    std::string label;
+    size_type label_size = 0;
+
+    while (is.read((char*) &label_size, sizeof(size_type))) {
+      label.resize(label_size);
+      is.read((char*) &(*label.begin()), label_size);
+
+      const size_type offset = category_type(label).non_terminal_id() * block;
+
+      if (offset + block > rows_)
+	throw std::runtime_error("invalid category in quantized matrix: " + label);
+
+      if (precision_ == INT8) {
+	is.read((char*) &scale_[offset], sizeof(parameter_type) * block);
+	is.read((char*) &int8_[offset * cols_], sizeof(int8_t) * block * cols_);
+      } else
+	is.read((char*) &half_[offset * cols_], sizeof(uint16_t) * block * cols_);
+    }
+  }
+};
@@ -0,0 +1,134 @@
+// -*- mode: c++ -*-
+//
+//  Copyright(C) 2014 Taro Watanabe <taro.watanabe@nict.go.jp>
+//
+
+#ifndef __TRANCE__QUANTIZED__HPP__
+#define __TRANCE__QUANTIZED__HPP__ 1
+
+//
+// quantized weights for inference
+//
+// A matrix is stored row-major either by int8 with a scale for each row, or by fp16.
+// The matrix-vector product of a block is accumulated in int32 (int8) or in fp32 (fp16),
+// by AVX2 kernels when the cpu supports them.
+//
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <trance/symbol.hpp>
+
+#include <Eigen/Core>
+
+#include <boost/filesystem/path.hpp>
+
+namespace trance
+{
+  class Quantized
+  {
+  public:
+    typedef size_t    size_type;
+    typedef ptrdiff_t difference_type;
+    typedef float     parameter_type;
+
+    typedef Symbol symbol_type;
+    typedef symbol_type category_type;
+
+    typedef boost::filesystem::path path_type;
+
+    typedef Eigen::Matrix<parameter_type, Eigen::Dynamic, Eigen::Dynamic> tensor_type;
+
+    typedef std::vector<category_type, std::allocator<category_type> > category_set_type;
+
+    typedef enum {
+      NONE,
+      INT8,
+      FP16,
+    } precision_type;
+
+    typedef std::vector<int8_t, std::allocator<int8_t> >                 int8_set_type;
+    typedef std::vector<uint16_t, std::allocator<uint16_t> >             half_set_type;
+    typedef std::vector<parameter_type, std::allocator<parameter_type> > scale_set_type;
+
+  public:
+    Quantized() : precision_(NONE), rows_(0), cols_(0) {}
+
+    static precision_type precision(const std::string& name);
+    static std::string    name(const precision_type& precision);
+
+  public:
+    // quantize the matrix
+    void assign(const tensor_type& matrix, const precision_type& precision);
+
+    // y += W.block(row, col, rows, cols) * x
+    void accumulate(const size_type row,
+		    const size_type col,
+		    const size_type rows,
+		    const size_type cols,
+		    const parameter_type* x,
+		    parameter_type* y) const;
+
+    // IO by the category blocks of rows, similar to Model::write_category
+    void write(const path_type& path,
+	       const category_set_type& categories,
+	       const size_type block) const;
+    void read(const path_type& path,
+	      const precision_type& precision,
+	      const size_type rows,
+	      const size_type cols,
+	      const size_type block);
+
+  public:
+    bool empty() const { return precision_ == NONE; }
+
+    size_type size_bytes() const
+    {
+      return int8_.size() * sizeof(int8_t) + half_.size() * sizeof(uint16_t) + scale_.size() * sizeof(parameter_type);
+    }
+
+    void clear()
+    {
+      precision_ = NONE;
+      rows_ = 0;
+      cols_ = 0;
+
+      int8_.clear();
+      half_.clear();
+      scale_.clear();
+    }
+
+    void swap(Quantized& x)
+    {
+      std::swap(precision_, x.precision_);
+      std::swap(rows_, x.rows_);
+      std::swap(cols_, x.cols_);
+
+      int8_.swap(x.int8_);
+      half_.swap(x.half_);
+      scale_.swap(x.scale_);
+    }
+
+  public:
+    precision_type precision_;
+    size_type rows_;
+    size_type cols_;
+
+    int8_set_type  int8_;
+    half_set_type  half_;
+    scale_set_type scale_;
+  };
+};
+
+namespace std
+{
+  inline
+  void swap(trance::Quantized& x, trance::Quantized& y)
+  {
+    x.swap(y);
+  }
+};
+
+#endif
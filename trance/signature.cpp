@@ -1,4 +1,6 @@
 
+#include <vector>
+
 #include "signature.hpp"
 #include "option.hpp"
 
@@ -6,8 +8,79 @@
 #include "signature/english.hpp"
 #include "signature/unicode.hpp"
 
+#include "utils/config.hpp"
+#include "utils/thread_specific_ptr.hpp"
+#include "utils/bithack.hpp"
+
 namespace trance
 {
+  struct SignatureImpl
+  {
+    typedef Signature::symbol_type::id_type id_type;
+
+    typedef std::vector<id_type, std::allocator<id_type> > id_map_type;
+
+    // signature id for each word id, or id_type(-1) when not computed yet
+    id_map_type maps_[Signature::KIND_SIZE];
+  };
+
+  namespace signature_impl
+  {
+#ifdef HAVE_TLS
+    static __thread SignatureImpl*                   impl_tls = 0;
+    static utils::thread_specific_ptr<SignatureImpl> impl;
+#else
+    static utils::thread_specific_ptr<SignatureImpl> impl;
+#endif
+
+    static SignatureImpl& instance()
+    {
+#ifdef HAVE_TLS
+      if (! impl_tls) {
+	impl.reset(new SignatureImpl());
+	impl_tls = impl.get();
+      }
+
+      return *impl_tls;
+#else
+      if (! impl.get())
+	impl.reset(new SignatureImpl());
+
+      return *impl;
+#endif
+    }
+  };
+
+  Signature::symbol_type Signature::operator()(const symbol_type& word) const
+  {
+    typedef SignatureImpl::id_type id_type;
+
+    // the ephemeral symbols are not memoized, since their ids are reused after their scope
+    if (kind_ == NONE || word.ephemeral())
+      return signature(word);
+
+    SignatureImpl::id_map_type& maps = signature_impl::instance().maps_[kind_];
+
+    if (word.id() >= maps.size()) {
+      const size_t size = word.id() + 1;
+      const size_t power2 = utils::bithack::branch(utils::bithack::is_power2(size),
+						   size,
+						   size_t(utils::bithack::next_largest_power2(size)));
+      maps.resize(power2, id_type(-1));
+    }
+
+    if (maps[word.id()] == id_type(-1)) {
+      const symbol_type sig = signature(word);
+
+      if (sig.ephemeral())
+	return sig;
+
+      maps[word.id()] = sig.id();
+    }
+
+    return symbol_type(maps[word.id()]);
+  }
+
   Signature::signature_ptr_type Signature::create(const utils::piece& param)
   {
     typedef trance::Option option_type;
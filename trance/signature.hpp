@@ -25,8 +25,18 @@ namespace trance
     typedef Signature signature_type;
     typedef boost::shared_ptr<signature_type> signature_ptr_type;
     
+    // kind of signature, which identifies the memo table
+    typedef enum {
+      NONE,
+      ENGLISH,
+      CHINESE,
+      UNICODE,
+      KIND_SIZE,
+    } kind_type;
+    
   public:
-    Signature() {}
+    Signature() : kind_(NONE) {}
+    Signature(const kind_type& kind) : kind_(kind) {}
     virtual ~Signature() {}
     
   public:
@@ -40,11 +50,18 @@ namespace trance
       return signature_ptr_type(new Signature());
     }
     
+    // the signature of the word, memoized by a thread-local table for each kind of signature
+    symbol_type operator()(const symbol_type& word) const;
+    
+    // compute the signature of the word
     virtual
-    symbol_type operator()(const symbol_type& word) const
+    symbol_type signature(const symbol_type& word) const
     {
       return symbol_type::UNK;
     }
+    
+  private:
+    kind_type kind_;
   };
 };
 
@@ -53,7 +53,8 @@ namespace trance
       
     public:
       Chinese()
-	: number_match_(".*[[:^Numeric_Type=None:]〇○◯].*"),
+	: Signature(CHINESE),
+	  number_match_(".*[[:^Numeric_Type=None:]〇○◯].*"),
 	  date_match_(".*[[:^Numeric_Type=None:]〇○◯].*[年月日号]"),
 	  ordinal_match_("第.*"),
 	  proper_name_match_(".*[··•․‧∙⋅・].*"),
@@ -74,7 +75,7 @@ namespace trance
     public:
       signature_ptr_type clone() const { return signature_ptr_type(new Chinese()); }
 
-      symbol_type operator()(const symbol_type& symbol) const
+      symbol_type signature(const symbol_type& symbol) const
       {
 	const std::string& word = static_cast<const std::string&>(symbol);
 	icu::UnicodeString uword = icu::UnicodeString::fromUTF8(icu::StringPiece(word.data(), word.size()));
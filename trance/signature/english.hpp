@@ -18,10 +18,13 @@ namespace trance
   {
     class English : public trance::Signature
     {
+    public:
+      English() : Signature(ENGLISH) {}
+      
     public:
       signature_ptr_type clone() const { return signature_ptr_type(new English()); }
       
-      symbol_type operator()(const symbol_type& symbol) const
+      symbol_type signature(const symbol_type& symbol) const
       {
 	const std::string& word = static_cast<const std::string&>(symbol);
 	icu::UnicodeString uword = icu::UnicodeString::fromUTF8(icu::StringPiece(word.data(), word.size()));
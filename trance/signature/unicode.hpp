@@ -26,7 +26,8 @@ namespace trance
 
     public:
       Unicode()
-	: script_(USCRIPT_CODE_LIMIT),
+	: Signature(UNICODE),
+	  script_(USCRIPT_CODE_LIMIT),
 	  general_category_(U_CHAR_CATEGORY_COUNT)
       {
 	for (int i = 0; i < USCRIPT_CODE_LIMIT; ++ i)
@@ -43,7 +44,7 @@ namespace trance
     public:
       signature_ptr_type clone() const { return signature_ptr_type(new Unicode()); }
       
-      symbol_type operator()(const symbol_type& symbol) const
+      symbol_type signature(const symbol_type& symbol) const
       {
 	const std::string& word = static_cast<const std::string&>(symbol);
 	icu::UnicodeString uword = icu::UnicodeString::fromUTF8(icu::StringPiece(word.data(), word.size()));
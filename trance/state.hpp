@@ -12,6 +12,8 @@
 #include <trance/feature_state.hpp>
 #include <trance/feature_vector.hpp>
 
+#include <utils/hashmurmur3.hpp>
+
 #include <boost/functional/hash/hash.hpp>
 
 namespace trance
@@ -60,6 +62,14 @@ namespace trance
     operator bool() const { return ! empty(); }
     
   private:
+    // The fields are placed by their use. The hot fields, which are accessed when the successors are
+    // scored and when the beam is pruned, come first and fit in the first 32 bytes, so that they share a
+    // cache line. The cold fields, which are followed only by the back-pointers and the features, come next,
+    // and the hidden layer is 32-byte aligned.
+    
+    // scoring
+    // score_type score_;
+    
     // state information
     // index_type step_;
     // index_type next_;
@@ -68,6 +78,7 @@ namespace trance
     // operation_type operation_;
     // symbol_type label_;
     // symbol_tyep head_;
+
     // span_type   span_;
     
     // stack and derivation
@@ -79,14 +90,13 @@ namespace trance
     // feature_state_type  featur_state_;
     // feature_vector_type* featur_vector_;
     
-    // scoring
-    // score_type score_;
-    
     // neural network
     // tensor_type layer_;
     
   public:
-    static const size_type offset_step       = 0;
+    static const size_type offset_score      = 0;
+    
+    static const size_type offset_step       = offset_score + sizeof(score_type);
     static const size_type offset_next       = offset_step + sizeof(index_type);
     static const size_type offset_unary      = offset_next + sizeof(index_type);
 
@@ -94,18 +104,17 @@ namespace trance
 
     static const size_type offset_label      = offset_operation + sizeof(operation_type);
     static const size_type offset_head       = offset_label + sizeof(symbol_type);
+    
     static const size_type offset_span       = offset_head + sizeof(symbol_type);
     
-    static const size_type offset_stack      = (offset_span + sizeof(span_type) + 15) & (~15);
+    static const size_type offset_stack      = (offset_span + sizeof(span_type) + 7) & (~7);
     static const size_type offset_derivation = offset_stack + sizeof(pointer);
     static const size_type offset_reduced    = offset_derivation + sizeof(pointer);
     
-    static const size_type offset_feature_state  = (offset_reduced + sizeof(pointer) + 15) & (~15);
+    static const size_type offset_feature_state  = (offset_reduced + sizeof(pointer) + 7) & (~7);
     static const size_type offset_feature_vector = offset_feature_state + sizeof(feature_state_type);
     
-    static const size_type offset_score      = offset_feature_vector + sizeof(feature_vector_type*);
-    
-    static const size_type offset_layer      = (offset_score + sizeof(score_type) + 15) & (~15);
+    static const size_type offset_layer      = (offset_feature_vector + sizeof(feature_vector_type*) + 31) & (~31);
     
   public:
     static size_type size(const size_type rows)
@@ -168,7 +177,62 @@ namespace trance
     {
       return adapted_type(reinterpret_cast<parameter_type*>(buffer_ + offset_layer), rows, 1);
     }
+
+    // the hidden layer with the compile-time rows, or Eigen::Dynamic
+    template <int Rows>
+    inline const Eigen::Map<const Eigen::Matrix<parameter_type, Rows, 1> > layer(const size_type rows) const
+    {
+      return Eigen::Map<const Eigen::Matrix<parameter_type, Rows, 1> >(reinterpret_cast<const parameter_type*>(buffer_ + offset_layer), rows, 1);
+    }
+
+    template <int Rows>
+    inline       Eigen::Map<Eigen::Matrix<parameter_type, Rows, 1> > layer(const size_type rows)
+    {
+      return Eigen::Map<Eigen::Matrix<parameter_type, Rows, 1> >(reinterpret_cast<parameter_type*>(buffer_ + offset_layer), rows, 1);
+    }
         
+  public:
+    // signature for the recombination of states. Two states are regarded equivalent when they share the position,
+    // the # of unaries and the unary closure, and the labels, spans and feature states of all the elements in the
+    // stack. Their hidden layers are not compared, thus the recombination is an approximation.
+    
+    template <typename Features>
+    size_t signature(const Features& feats) const
+    {
+      size_t seed = utils::hashmurmur3<size_t>()(buffer_ + offset_next, sizeof(index_type) * 2, operation().closure());
+      
+      for (state_type state = *this; state; state = state.stack()) {
+	seed = utils::hashmurmur3<size_t>()(state.buffer_ + offset_label, sizeof(symbol_type), seed);
+	seed = utils::hashmurmur3<size_t>()(state.buffer_ + offset_span,  sizeof(span_type),   seed);
+	seed = feats.hash(state.feature_state(), seed);
+      }
+      
+      return seed;
+    }
+    
+    template <typename Features>
+    bool equivalent(const state_type& x, const Features& feats) const
+    {
+      if (next() != x.next() || unary() != x.unary()
+	  || operation().closure() != x.operation().closure()
+	  || operation().finished() != x.operation().finished())
+	return false;
+      
+      state_type state1 = *this;
+      state_type state2 = x;
+      
+      for (/**/; state1 && state2; state1 = state1.stack(), state2 = state2.stack()) {
+	if (state1 == state2) return true;
+	
+	if (state1.label() != state2.label()
+	    || state1.span() != state2.span()
+	    || ! feats.equal(state1.feature_state(), state2.feature_state()))
+	  return false;
+      }
+      
+      return ! state1 && ! state2;
+    }
+    
   public:
     
     friend
@@ -3,6 +3,8 @@
 //
 
 #include <iterator>
+#include <stdexcept>
+#include <algorithm>
 
 #define BOOST_DISABLE_ASSERTS
 #define BOOST_SPIRIT_THREADSAFE
@@ -21,6 +23,7 @@
 #include <utils/thread_specific_ptr.hpp>
 #include <utils/simple_vector.hpp>
 #include <utils/array_power2.hpp>
+#include <utils/unordered_map.hpp>
 
 #include "symbol.hpp"
 
@@ -31,6 +34,7 @@ namespace trance
     typedef Symbol::symbol_map_type symbol_map_type;
     typedef Symbol::id_type         id_type;
     typedef Symbol::mutex_type      mutex_type;
+    typedef Symbol::piece_type      piece_type;
 
     typedef utils::indexed_set<id_type, boost::hash<id_type>, std::equal_to<id_type>, std::allocator<id_type> > non_terminal_set_type;
 
@@ -38,13 +42,122 @@ namespace trance
     typedef std::vector<id_type, std::allocator<id_type> > non_terminal_id_map_type;
     typedef utils::simple_vector<id_type, std::allocator<id_type> > id_set_type;
 
+    // the keys refer to the strings of the global symbols, which are never moved
+    typedef utils::unordered_map<piece_type, id_type, boost::hash<piece_type>, std::equal_to<piece_type>,
+				 std::allocator<std::pair<const piece_type, id_type> > >::type index_cache_type;
+
     symbol_map_type              symbol_maps_;
     non_terminal_map_type        non_terminal_maps_;
     non_terminal_id_map_type     non_terminal_id_maps_;
   };
 
+  // the ephemeral symbols of a thread, which are kept in a slot shared by the threads. The strings are placed in
+  // chunks which are never moved, so that the other threads, i.e. the workers of the parser, may read them while the
+  // owner allocates new ones. The strings and the index are reused after the scope, thus the memory stays flat.
+  struct SymbolEphemeral
+  {
+    typedef Symbol::size_type   size_type;
+    typedef Symbol::id_type     id_type;
+    typedef Symbol::symbol_type symbol_type;
+    typedef Symbol::piece_type  piece_type;
+
+    typedef utils::unordered_map<piece_type, id_type, boost::hash<piece_type>, std::equal_to<piece_type>,
+				 std::allocator<std::pair<const piece_type, id_type> > >::type index_type;
+
+    static const size_type chunk_size = 1024;
+    static const size_type chunk_max  = Symbol::ephemeral_size / chunk_size;
+
+    SymbolEphemeral(const id_type slot) : slot_(slot), size_(0), depth_(0)
+    {
+      std::fill(chunks_, chunks_ + chunk_max, (symbol_type*) 0);
+    }
+
+    ~SymbolEphemeral()
+    {
+      for (size_type i = 0; i != chunk_max; ++ i)
+	delete [] chunks_[i];
+
+      release(slot_);
+    }
+
+    const symbol_type& operator[](const size_type pos) const
+    {
+      return chunks_[pos / chunk_size][pos % chunk_size];
+    }
+
+    id_type find(const piece_type& x) const
+    {
+      index_type::const_iterator iter = index_.find(x);
+
+      return (iter == index_.end() ? id_type(-1) : iter->second);
+    }
+
+    // id_type(-1) when the slot is full
+    id_type insert(const piece_type& x)
+    {
+      if (size_ + 1 >= Symbol::ephemeral_size) return id_type(-1);
+
+      symbol_type*& chunk = chunks_[size_ / chunk_size];
+      if (! chunk)
+	chunk = new symbol_type[chunk_size];
+
+      symbol_type& stored = chunk[size_ % chunk_size];
+      stored.assign(x.begin(), x.end());
+
+      const id_type id = Symbol::ephemeral_flag | (slot_ << Symbol::ephemeral_bits) | id_type(size_);
+
+      index_.insert(std::make_pair(piece_type(stored), id));
+      ++ size_;
+
+      return id;
+    }
+
+    void clear()
+    {
+      index_.clear();
+      size_ = 0;
+    }
+
+    static SymbolEphemeral* acquire();
+    static void release(const id_type slot);
+
+    id_type      slot_;
+    size_type    size_;
+    size_type    depth_;
+    index_type   index_;
+    symbol_type* chunks_[chunk_max];
+  };
+
   Symbol::ticket_type    Symbol::__mutex;
 
+  const Symbol::id_type Symbol::ephemeral_flag;
+  const Symbol::id_type Symbol::ephemeral_bits;
+  const Symbol::id_type Symbol::ephemeral_size;
+  const Symbol::id_type Symbol::ephemeral_slots;
+
+  // zero initialized before any dynamic initialization
+  static volatile int32_t  __ephemeral_used[Symbol::ephemeral_slots];
+  static SymbolEphemeral*  __ephemerals[Symbol::ephemeral_slots];
+
+  SymbolEphemeral* SymbolEphemeral::acquire()
+  {
+    for (id_type slot = 0; slot != Symbol::ephemeral_slots; ++ slot)
+      if (! __ephemeral_used[slot] && utils::atomicop::compare_and_swap(__ephemeral_used[slot], int32_t(0), int32_t(1))) {
+	__ephemerals[slot] = new SymbolEphemeral(slot);
+	utils::atomicop::memory_barrier();
+	return __ephemerals[slot];
+      }
+
+    return 0;
+  }
+
+  void SymbolEphemeral::release(const id_type slot)
+  {
+    __ephemerals[slot] = 0;
+    utils::atomicop::memory_barrier();
+    __ephemeral_used[slot] = 0;
+  }
+
   static SymbolImpl::mutex_type            __non_terminal_mutex;
   static SymbolImpl::non_terminal_set_type __non_terminal_map;
 
@@ -73,8 +186,103 @@ namespace trance
       return *impl;
 #endif
     }
+
+    // the owner is local to the function, since the symbols may be allocated during the static initialization
+    static SymbolImpl::index_cache_type& index_cache()
+    {
+#ifdef HAVE_TLS
+      static __thread SymbolImpl::index_cache_type*                   cache_tls = 0;
+      static utils::thread_specific_ptr<SymbolImpl::index_cache_type> cache;
+
+      if (! cache_tls) {
+	cache.reset(new SymbolImpl::index_cache_type());
+	cache_tls = cache.get();
+      }
+
+      return *cache_tls;
+#else
+      static utils::thread_specific_ptr<SymbolImpl::index_cache_type> cache;
+
+      if (! cache.get())
+	cache.reset(new SymbolImpl::index_cache_type());
+
+      return *cache;
+#endif
+    }
+
+    // the ephemeral symbols of the thread, allocated by the first scope of the thread. When all the slots are
+    // taken, the symbols are allocated in the global table.
+    struct ephemeral_owner
+    {
+      SymbolEphemeral* ephemeral_;
+      bool             acquired_;
+
+      ephemeral_owner() : ephemeral_(0), acquired_(false) {}
+      ~ephemeral_owner() { delete ephemeral_; }
+    };
+
+    static ephemeral_owner& ephemeral_instance()
+    {
+#ifdef HAVE_TLS
+      static __thread ephemeral_owner*                   owner_tls = 0;
+      static utils::thread_specific_ptr<ephemeral_owner> owner;
+
+      if (! owner_tls) {
+	owner.reset(new ephemeral_owner());
+	owner_tls = owner.get();
+      }
+
+      return *owner_tls;
+#else
+      static utils::thread_specific_ptr<ephemeral_owner> owner;
+
+      if (! owner.get())
+	owner.reset(new ephemeral_owner());
+
+      return *owner;
+#endif
+    }
+
+    // the ephemeral symbols of the thread in a scope, or 0
+    static SymbolEphemeral* ephemeral()
+    {
+      SymbolEphemeral* ephemeral = ephemeral_instance().ephemeral_;
+
+      return (ephemeral && ephemeral->depth_ ? ephemeral : 0);
+    }
   };
 
+  void SymbolScope::enter()
+  {
+    symbol_impl::ephemeral_owner& owner = symbol_impl::ephemeral_instance();
+
+    if (! owner.acquired_) {
+      owner.ephemeral_ = SymbolEphemeral::acquire();
+      owner.acquired_  = true;
+    }
+
+    if (owner.ephemeral_)
+      ++ owner.ephemeral_->depth_;
+  }
+
+  void SymbolScope::leave()
+  {
+    SymbolEphemeral* ephemeral = symbol_impl::ephemeral_instance().ephemeral_;
+
+    if (ephemeral && ephemeral->depth_ && -- ephemeral->depth_ == 0)
+      ephemeral->clear();
+  }
+
+  const Symbol::symbol_type& Symbol::__ephemeral_symbol(const id_type& id)
+  {
+    const SymbolEphemeral* ephemeral = __ephemerals[(id >> ephemeral_bits) & (ephemeral_slots - 1)];
+
+    if (! ephemeral)
+      throw std::runtime_error("ephemeral symbol out of its scope");
+
+    return (*ephemeral)[id & (ephemeral_size - 1)];
+  }
+
   // constants
   const Symbol Symbol::EMPTY   = Symbol("");
   const Symbol Symbol::EPSILON = Symbol("<epsilon>");
@@ -84,6 +292,69 @@ namespace trance
   const Symbol Symbol::FINAL   = Symbol("[-FINAL-]");
   const Symbol Symbol::IDLE    = Symbol("[-IDLE-]");
 
+  Symbol::id_type Symbol::__allocate(const piece_type& x)
+  {
+    SymbolImpl::index_cache_type& cache = symbol_impl::index_cache();
+
+    SymbolImpl::index_cache_type::const_iterator citer = cache.find(x);
+    if (citer != cache.end())
+      return citer->second;
+
+    // the symbols of the scope are looked up before the global table, so that a symbol keeps its id in the scope
+    SymbolEphemeral* ephemeral = symbol_impl::ephemeral();
+
+    if (ephemeral) {
+      const id_type id = ephemeral->find(x);
+
+      if (id != id_type(-1))
+	return id;
+    }
+
+    id_type id = id_type(-1);
+    const symbol_type* stored = 0;
+
+    {
+      ticket_type::scoped_reader_lock lock(__mutex);
+
+      const symbol_index_type& index = __index();
+
+      symbol_index_type::const_iterator iter = index.find(x);
+
+      if (iter != index.end()) {
+	id = iter - index.begin();
+	stored = &(__symbols()[id]);
+      }
+    }
+
+    if (! stored && ephemeral) {
+      const id_type id = ephemeral->insert(x);
+
+      if (id != id_type(-1))
+	return id;
+    }
+
+    if (! stored) {
+      ticket_type::scoped_writer_lock lock(__mutex);
+
+      symbol_index_type& index = __index();
+
+      std::pair<symbol_index_type::iterator, bool> result = index.insert(x);
+
+      if (result.second) {
+	symbol_set_type& symbols = __symbols();
+	symbols.push_back(x);
+	const_cast<piece_type&>(*result.first) = symbols.back();
+      }
+
+      id = result.first - index.begin();
+      stored = &(__symbols()[id]);
+    }
+
+    cache.insert(std::make_pair(piece_type(*stored), id));
+
+    return id;
+  }
+
   Symbol::symbol_map_type& Symbol::__symbol_maps()
   {
     return symbol_impl::instance().symbol_maps_;
@@ -91,6 +362,9 @@ namespace trance
 
   bool Symbol::non_terminal() const
   {
+    // the ephemeral symbols are unseen words
+    if (ephemeral()) return false;
+
     SymbolImpl::non_terminal_map_type& maps =  symbol_impl::instance().non_terminal_maps_;
 
     const size_type scan_pos = (id_ << 1);
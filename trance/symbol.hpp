@@ -28,11 +28,15 @@ namespace trance
 {
   
   struct SymbolImpl;
+  struct SymbolEphemeral;
+  class SymbolScope;
 
   class Symbol
   {
   private:
     friend struct SymbolImpl;
+    friend struct SymbolEphemeral;
+    friend class SymbolScope;
 
   public:
     typedef std::string  symbol_type;
@@ -63,6 +67,13 @@ namespace trance
     static const Symbol FINAL;
     static const Symbol IDLE;
     
+  public:
+    // the id of an ephemeral symbol is the flag, the slot of the thread and the position in the slot
+    static const id_type ephemeral_flag  = id_type(1) << 31;
+    static const id_type ephemeral_bits  = 20;
+    static const id_type ephemeral_size  = id_type(1) << ephemeral_bits;
+    static const id_type ephemeral_slots = id_type(1) << 11;
+    
   public:
     Symbol() : id_(__allocate_empty()) { }
     Symbol(const piece_type& x) : id_(__allocate(x)) { }
@@ -87,6 +98,9 @@ namespace trance
     
     const symbol_type& symbol() const
     {
+      if (ephemeral())
+	return __ephemeral_symbol(id_);
+      
       symbol_map_type& maps = __symbol_maps();
       
       if (id_ >= maps.size()) {
@@ -118,6 +132,9 @@ namespace trance
     size_type size() const { return symbol().size(); }
     bool empty() const { return symbol().empty(); }
     
+    // ephemeral symbol, which is valid only in the scope of the thread which allocated it
+    bool ephemeral() const { return id_ & ephemeral_flag; }
+    
     // non-terminal id
     id_type non_terminal_id() const;
     
@@ -189,6 +206,8 @@ namespace trance
     
     static symbol_map_type& __symbol_maps();
     
+    static const symbol_type& __ephemeral_symbol(const id_type& id);
+    
     static symbol_set_type& __symbols()
     {
       static symbol_set_type syms;
@@ -207,27 +226,34 @@ namespace trance
       return id_;
     }
     
-    static id_type __allocate(const piece_type& x)
-    {
-      ticket_type::scoped_writer_lock lock(__mutex);
-
-      symbol_index_type& index = __index();
-      
-      std::pair<symbol_index_type::iterator, bool> result = index.insert(x);
-      
-      if (result.second) {
-	symbol_set_type& symbols = __symbols();
-	symbols.push_back(x);
-	const_cast<piece_type&>(*result.first) = symbols.back();
-      }
-      
-      return result.first - index.begin();
-    }
+    // the symbols already seen by the thread are looked up without locking, then the global index by the reader
+    // lock, and only the new symbols are inserted by the writer lock
+    static id_type __allocate(const piece_type& x);
     
   private:
     id_type id_;
   };
   
+  // ephemeral symbols
+  //
+  // While a scope is alive in a thread, the symbols not in the global table are allocated in the ephemeral space of
+  // the thread, and released when the outermost scope ends, so that a long running parser does not grow the global
+  // table by the unseen words of its inputs. The symbols of the scope, and everything computed from them, should not
+  // be kept after the scope.
+  class SymbolScope
+  {
+  public:
+    SymbolScope() { enter(); }
+    ~SymbolScope() { leave(); }
+    
+  private:
+    SymbolScope(const SymbolScope&) {}
+    SymbolScope& operator=(const SymbolScope&) { return *this; }
+    
+    static void enter();
+    static void leave();
+  };
+  
   inline
   size_t hash_value(Symbol const& x)
   {
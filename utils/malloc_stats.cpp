@@ -17,6 +17,10 @@
 #include <malloc/malloc.h>
 #endif
 
+#if defined(HAVE_MALLOC_H)
+#include <malloc.h>
+#endif
+
 #if defined(HAVE_GOOGLE_MALLOC_EXTENSION)
   #if defined(HAVE_GPERFTOOLS_MALLOC_EXTENSION_H)
     #include <gperftools/malloc_extension.h>
@@ -61,6 +65,9 @@ namespace utils
     struct malloc_statistics_t stat;
     malloc_zone_statistics(NULL, &stat);
     return stat.size_in_use;
+#elif defined(HAVE_MALLINFO2)
+    const struct mallinfo2 info = ::mallinfo2();
+    return info.uordblks + info.hblkhd;
 #elif defined(HAVE_SBRK)
     static char *memory_begin = reinterpret_cast<char*>(::sbrk(0));
     char *memory_end = reinterpret_cast<char*>(::sbrk(0));
@@ -99,6 +106,9 @@ namespace utils
     struct malloc_statistics_t stat;
     malloc_zone_statistics(NULL, &stat);
     return stat.size_allocated;
+#elif defined(HAVE_MALLINFO2)
+    const struct mallinfo2 info = ::mallinfo2();
+    return info.arena + info.hblkhd;
 #else
 #warning "no reliable malloc statics..."
     return 0;